@@ -0,0 +1,445 @@
+// Runs every kernel the filter can dispatch on synthetic planes, without an AviSynth host.
+// sbr_bench [--json] [--filter <substring>] [--min-time <seconds>] [--strip <columns>] [--stream <fraction>] [--instances <count>] [--threads <count>] [--passes <count>] [--output <0..2>]
+// --strip sets the strip width of sbr_fused() (0: whole rows); by default it is the one the filter uses on this CPU.
+// --stream writes planes larger than this fraction of the last-level cache with non-temporal stores like the filter (default 0.5, negative: never).
+// --instances runs that many copies of every kernel at the same time, each on planes of its own, like several encodes sharing the CPU.
+// --threads runs every kernel on 1 to that many threads like the filter with threads=n: the frame is cut into bands of rows that the threads
+// pull from a shared queue, each with a scratch of its own. Every thread count is one result (frames/s); it does not combine with --instances.
+// Every result also gives the scratch of all instances: the ring of sbr_fused() and the band buffers of sbr_passes() of every thread, against
+// the arena that every instance of the filter allocated before the kernels were fused: height * pitch * 2 elements of sample size * sample
+// size bytes (the allocation counted elements, so the sample size is in it twice).
+// --passes applies every kernel that many times to its own output through sbr_passes() like the filter (sbrStack is skipped then).
+// --output selects what the kernels write like the filter: 0 the plane, 1 the difference, 2 both (sbrStack is skipped for 1 and 2).
+// Every result also tells whether the filter would filter a writable source frame in place, where copied planes cost no copy.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "sbr_kernels.h"
+
+struct kernel
+{
+    const char* name;
+    const char* isa;
+    int opt; // the tier of the kernel (opt of the filter)
+    int bits; // 32 is float
+    int filter; // 0: sbrV, 1: sbr, 2: sbrH, 3: sbrStack
+    sbr_kernel fn;
+};
+
+#define SBR_KERNELS_8(isa, opt) \
+    { "sbr_" #isa "_8<0>", #isa, opt, 8, 0, sbr_##isa##_8<0> }, \
+    { "sbr_" #isa "_8<1>", #isa, opt, 8, 1, sbr_##isa##_8<1> }, \
+    { "sbr_" #isa "_8<2>", #isa, opt, 8, 2, sbr_##isa##_8<2> }, \
+    { "sbr_" #isa "_8<3>", #isa, opt, 8, 3, sbr_##isa##_8<3> },
+#define SBR_KERNELS_16(isa, opt, bits) \
+    { "sbr_" #isa "_16<0> " #bits "-bit", #isa, opt, bits, 0, sbr_##isa##_16<0> }, \
+    { "sbr_" #isa "_16<1> " #bits "-bit", #isa, opt, bits, 1, sbr_##isa##_16<1> }, \
+    { "sbr_" #isa "_16<2> " #bits "-bit", #isa, opt, bits, 2, sbr_##isa##_16<2> }, \
+    { "sbr_" #isa "_16<3> " #bits "-bit", #isa, opt, bits, 3, sbr_##isa##_16<3> },
+#define SBR_KERNELS_32(isa, opt) \
+    { "sbr_" #isa "_32<0>", #isa, opt, 32, 0, sbr_##isa##_32<0> }, \
+    { "sbr_" #isa "_32<1>", #isa, opt, 32, 1, sbr_##isa##_32<1> }, \
+    { "sbr_" #isa "_32<2>", #isa, opt, 32, 2, sbr_##isa##_32<2> }, \
+    { "sbr_" #isa "_32<3>", #isa, opt, 32, 3, sbr_##isa##_32<3> },
+// 10..16-bit share the 16-bit kernels; 12-bit is the widest depth with 16-bit blur sums and 14-bit the narrowest with 32-bit ones.
+#define SBR_KERNELS(isa, opt) \
+    SBR_KERNELS_8(isa, opt) \
+    SBR_KERNELS_16(isa, opt, 10) \
+    SBR_KERNELS_16(isa, opt, 12) \
+    SBR_KERNELS_16(isa, opt, 14) \
+    SBR_KERNELS_16(isa, opt, 16) \
+    SBR_KERNELS_32(isa, opt)
+
+static const kernel kernels[]
+{
+    { "sbr_c<uint8_t, 0>", "c", 0, 8, 0, sbr_c<uint8_t, 0> },
+    { "sbr_c<uint8_t, 1>", "c", 0, 8, 1, sbr_c<uint8_t, 1> },
+    { "sbr_c<uint8_t, 2>", "c", 0, 8, 2, sbr_c<uint8_t, 2> },
+    { "sbr_c<uint8_t, 3>", "c", 0, 8, 3, sbr_c<uint8_t, 3> },
+    { "sbr_c<uint16_t, 0> 10-bit", "c", 0, 10, 0, sbr_c<uint16_t, 0> },
+    { "sbr_c<uint16_t, 1> 10-bit", "c", 0, 10, 1, sbr_c<uint16_t, 1> },
+    { "sbr_c<uint16_t, 2> 10-bit", "c", 0, 10, 2, sbr_c<uint16_t, 2> },
+    { "sbr_c<uint16_t, 3> 10-bit", "c", 0, 10, 3, sbr_c<uint16_t, 3> },
+    { "sbr_c<uint16_t, 0> 12-bit", "c", 0, 12, 0, sbr_c<uint16_t, 0> },
+    { "sbr_c<uint16_t, 1> 12-bit", "c", 0, 12, 1, sbr_c<uint16_t, 1> },
+    { "sbr_c<uint16_t, 2> 12-bit", "c", 0, 12, 2, sbr_c<uint16_t, 2> },
+    { "sbr_c<uint16_t, 3> 12-bit", "c", 0, 12, 3, sbr_c<uint16_t, 3> },
+    { "sbr_c<uint16_t, 0> 14-bit", "c", 0, 14, 0, sbr_c<uint16_t, 0> },
+    { "sbr_c<uint16_t, 1> 14-bit", "c", 0, 14, 1, sbr_c<uint16_t, 1> },
+    { "sbr_c<uint16_t, 2> 14-bit", "c", 0, 14, 2, sbr_c<uint16_t, 2> },
+    { "sbr_c<uint16_t, 3> 14-bit", "c", 0, 14, 3, sbr_c<uint16_t, 3> },
+    { "sbr_c<uint16_t, 0> 16-bit", "c", 0, 16, 0, sbr_c<uint16_t, 0> },
+    { "sbr_c<uint16_t, 1> 16-bit", "c", 0, 16, 1, sbr_c<uint16_t, 1> },
+    { "sbr_c<uint16_t, 2> 16-bit", "c", 0, 16, 2, sbr_c<uint16_t, 2> },
+    { "sbr_c<uint16_t, 3> 16-bit", "c", 0, 16, 3, sbr_c<uint16_t, 3> },
+    { "sbr_c<float, 0>", "c", 0, 32, 0, sbr_c<float, 0> },
+    { "sbr_c<float, 1>", "c", 0, 32, 1, sbr_c<float, 1> },
+    { "sbr_c<float, 2>", "c", 0, 32, 2, sbr_c<float, 2> },
+    { "sbr_c<float, 3>", "c", 0, 32, 3, sbr_c<float, 3> },
+    SBR_KERNELS(sse2, 1)
+    SBR_KERNELS(avx2, 2)
+    SBR_KERNELS(avx512, 3)
+    SBR_KERNELS_8(avx512vnni, 4)
+    SBR_KERNELS(avx512vl, 5)
+};
+
+struct resolution
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+static const resolution resolutions[]
+{
+    { "480p", 854, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "1440p", 2560, 1440 },
+    { "2160p", 3840, 2160 },
+    { "4320p", 7680, 4320 },
+};
+
+struct aligned_plane
+{
+    void* p;
+
+    explicit aligned_plane(size_t size) : p(operator new(size, std::align_val_t{ 64 })) {}
+    ~aligned_plane() { operator delete(p, std::align_val_t{ 64 }); }
+};
+
+struct result
+{
+    const kernel* k;
+    const resolution* r;
+    double mpix_per_s;
+    double cycles_per_pixel;
+    double bytes_per_pixel;
+    double gb_per_s;
+    double frames_per_s;
+    int threads;
+    size_t scratch_bytes;
+    size_t old_arena_bytes;
+    bool stream;
+    bool in_place; // the filter would write over a writable source frame instead of a new one with copied planes
+};
+
+struct options
+{
+    double min_time;
+    int strip;
+    double stream;
+    int instances;
+    int threads;
+    int passes;
+    int output;
+};
+
+// Noise over the whole range with flat areas, so both branches of the select are taken.
+static void fill(void* p, int pitch, int width, int height, int bits, std::mt19937& rng)
+{
+    for (int y{ 0 }; y < height; ++y)
+    {
+        for (int x{ 0 }; x < width; ++x)
+        {
+            const bool flat{ (((x >> 6) + (y >> 6)) & 1) != 0 };
+
+            if (bits == 32)
+                reinterpret_cast<float*>(p)[y * pitch + x] = flat ? 0.5f : std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+            else
+            {
+                const int peak{ (1 << bits) - 1 };
+                const int v{ flat ? peak / 2 + static_cast<int>(rng() % 5) - 2 : static_cast<int>(rng() & peak) };
+
+                if (bits == 8)
+                    reinterpret_cast<uint8_t*>(p)[y * pitch + x] = static_cast<uint8_t>(v);
+                else
+                    reinterpret_cast<uint16_t*>(p)[y * pitch + x] = static_cast<uint16_t>(v);
+            }
+        }
+    }
+}
+
+static result run(const kernel& k, const resolution& r, const options& o, int threads)
+{
+    const int size{ (k.bits == 8) ? 1 : ((k.bits == 32) ? 4 : 2) };
+    // Same layout as a frame and as the scratch of the filter: 64-byte aligned rows.
+    const int pitch{ (r.width + 64 / size - 1) & ~(64 / size - 1) };
+    const size_t plane_size{ static_cast<size_t>(pitch) * r.height * size };
+    // sbrStack and output 2 write two planes.
+    const int outputs{ (k.filter == 3 || o.output == 2) ? 2 : 1 };
+    const int strip{ (o.strip < 0) ? cache_strip(size) : o.strip };
+    const int band{ cache_band(pitch * size) };
+    const size_t temp_size{ static_cast<size_t>(pitch) * scratch_rows(k.filter, o.passes, band) * size };
+    const bool stream{ o.stream >= 0.0 && plane_size * outputs > o.stream * cache_llc() };
+    // As GetFrame of the filter: one thread, no sbrStack, and the kernel may write over its source.
+    const bool in_place{ threads == 1 && k.filter != 3 && sbr_in_place(r.width, strip, o.passes, o.output) };
+
+    struct instance
+    {
+        aligned_plane src;
+        aligned_plane dst;
+        aligned_plane temp;
+
+        instance(size_t plane_size, size_t dst_size, size_t temp_size) : src(plane_size), dst(dst_size), temp(temp_size) {}
+    };
+
+    std::vector<std::unique_ptr<instance>> instances;
+
+    for (int i{ 0 }; i < o.instances; ++i)
+    {
+        instances.push_back(std::make_unique<instance>(plane_size, plane_size * outputs, temp_size));
+
+        std::mt19937 rng(r.width ^ k.bits ^ i);
+        fill(instances.back()->src.p, pitch, r.width, r.height, k.bits, rng);
+    }
+
+    // Rows [y_begin, y_end) of the planes of in, with the scratch temp.
+    const auto filter_rows{ [&](instance& in, void* temp, int y_begin, int y_end)
+        {
+            switch (size)
+            {
+                case 1: sbr_passes<uint8_t>(k.fn, o.passes, band, k.filter, in.dst.p, temp, in.src.p, pitch, pitch, pitch, r.width, r.height, y_begin, y_end, k.bits, strip, stream, o.output); break;
+                case 2: sbr_passes<uint16_t>(k.fn, o.passes, band, k.filter, in.dst.p, temp, in.src.p, pitch, pitch, pitch, r.width, r.height, y_begin, y_end, k.bits, strip, stream, o.output); break;
+                default: sbr_passes<float>(k.fn, o.passes, band, k.filter, in.dst.p, temp, in.src.p, pitch, pitch, pitch, r.width, r.height, y_begin, y_end, k.bits, strip, stream, o.output); break;
+            }
+        } };
+    const auto filter{ [&](instance& in) { filter_rows(in, in.temp.p, 0, r.height); } };
+
+    double best_s{ 1e30 };
+    double best_cycles{ 1e30 };
+
+    if (o.instances == 1)
+    {
+        // With threads, the workers wait for the next frame and take bands from next until none is left, like the workers of the filter;
+        // four bands per thread and at least 16 rows per pass, as there.
+        const int band_height{ std::max((r.height + threads * 4 - 1) / (threads * 4), 16 * o.passes) };
+        std::vector<std::unique_ptr<aligned_plane>> temps;
+        std::vector<std::thread> workers;
+        std::atomic<int> next{ 0 };
+        std::atomic<int> finished{ 0 };
+        std::atomic<int> frame{ 0 };
+        std::atomic<bool> stop{ false };
+
+        // The calling thread is index 0 and uses the scratch of the instance.
+        const auto take_bands{ [&](int index)
+            {
+                void* const temp{ (index == 0) ? instances[0]->temp.p : temps[index - 1]->p };
+
+                for (int y{ next.fetch_add(band_height) }; y < r.height; y = next.fetch_add(band_height))
+                    filter_rows(*instances[0], temp, y, std::min(y + band_height, r.height));
+            } };
+
+        for (int i{ 1 }; i < threads; ++i)
+            temps.push_back(std::make_unique<aligned_plane>(temp_size));
+
+        for (int i{ 1 }; i < threads; ++i)
+            workers.emplace_back([&, i]
+                {
+                    for (int seen{ 0 };;)
+                    {
+                        while (frame.load() == seen && !stop.load())
+                            std::this_thread::yield();
+
+                        if (stop.load())
+                            return;
+
+                        seen = frame.load();
+                        take_bands(i);
+                        ++finished;
+                    }
+                });
+
+        const auto run_frame{ [&]
+            {
+                if (threads == 1)
+                {
+                    filter(*instances[0]);
+                    return;
+                }
+
+                next = 0;
+                finished = 0;
+                ++frame;
+                take_bands(0);
+
+                while (finished.load() < threads - 1)
+                    std::this_thread::yield();
+            } };
+
+        run_frame();
+
+        double total_s{ 0.0 };
+
+        for (int i{ 0 }; i < 3 || total_s < o.min_time; ++i)
+        {
+            const auto start{ std::chrono::steady_clock::now() };
+            const uint64_t tsc_start{ __rdtsc() };
+
+            run_frame();
+
+            const uint64_t tsc_end{ __rdtsc() };
+            const double s{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+            best_s = std::min(best_s, s);
+            best_cycles = std::min(best_cycles, static_cast<double>(tsc_end - tsc_start));
+            total_s += s;
+        }
+
+        stop = true;
+
+        for (std::thread& t : workers)
+            t.join();
+    }
+    else
+    {
+        // The instances start together and run the same number of frames; the wall time of all of them is what a shared machine delivers.
+        double warm_s{ 0.0 };
+
+        for (auto& in : instances)
+        {
+            const auto start{ std::chrono::steady_clock::now() };
+            filter(*in);
+            warm_s = std::max(warm_s, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        const int frames{ std::max(3, static_cast<int>(o.min_time / warm_s)) };
+        std::atomic<bool> go{ false };
+        std::vector<std::thread> threads;
+
+        for (auto& in : instances)
+            threads.emplace_back([&, p = in.get()]
+                {
+                    while (!go.load())
+                        std::this_thread::yield();
+
+                    for (int i{ 0 }; i < frames; ++i)
+                        filter(*p);
+                });
+
+        const auto start{ std::chrono::steady_clock::now() };
+        const uint64_t tsc_start{ __rdtsc() };
+        go = true;
+
+        for (std::thread& t : threads)
+            t.join();
+
+        const uint64_t tsc_end{ __rdtsc() };
+
+        // Time per frame of the whole group, i.e. the instances count once per frame they finish together.
+        best_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / (static_cast<double>(frames) * o.instances);
+        best_cycles = static_cast<double>(tsc_end - tsc_start) / (static_cast<double>(frames) * o.instances);
+    }
+
+    const double pixels{ static_cast<double>(r.width) * r.height };
+    // The frame is read once and every output written once, for any number of passes; the rg11D rings, the sums and the intermediate rows stay in cache.
+    const double bytes_per_pixel{ (1.0 + outputs) * size };
+
+    return { &k, &r, pixels / best_s / 1e6, best_cycles / pixels, bytes_per_pixel, pixels * bytes_per_pixel / best_s / 1e9, 1.0 / best_s, threads, temp_size * threads * o.instances, plane_size * 2 * size * o.instances, stream, in_place };
+}
+
+int main(int argc, char** argv)
+{
+    bool json{ false };
+    std::string filter;
+    options o{ 0.25, -1, 0.5, 1, 1, 1, 0 };
+
+    for (int i{ 1 }; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--json"))
+            json = true;
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--min-time") && i + 1 < argc)
+            o.min_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--strip") && i + 1 < argc)
+            o.strip = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--stream") && i + 1 < argc)
+            o.stream = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--instances") && i + 1 < argc)
+            o.instances = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            o.threads = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--passes") && i + 1 < argc)
+            o.passes = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            o.output = std::clamp(atoi(argv[++i]), 0, 2);
+        else
+        {
+            fprintf(stderr, "usage: %s [--json] [--filter <substring>] [--min-time <seconds>] [--strip <columns>] [--stream <fraction>] [--instances <count>] [--threads <count>] [--passes <count>] [--output <0..2>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (o.instances > 1 && o.threads > 1)
+    {
+        fprintf(stderr, "%s: --threads and --instances cannot be combined\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<result> results;
+
+    if (!json)
+        printf("%-40s %-7s %7s %10s %10s %10s %10s %10s %7s %8s %12s %14s\n", "kernel", "size", "threads", "frames/s", "MPix/s", "cycles/px", "bytes/px", "GB/s", "stores", "frame",
+            "scratch KiB", "old arena KiB");
+
+    for (const kernel& k : kernels)
+    {
+        if (!isa_supported(k.opt) || (k.filter == 3 && (o.passes > 1 || o.output > 0)))
+            continue;
+
+        for (const resolution& r : resolutions)
+        {
+            if (!filter.empty() && (std::string(k.name) + " " + r.name).find(filter) == std::string::npos)
+                continue;
+
+            for (int threads{ 1 }; threads <= o.threads; ++threads)
+            {
+                results.push_back(run(k, r, o, threads));
+
+                if (!json)
+                {
+                    const result& res{ results.back() };
+                    printf("%-40s %-7s %7d %10.1f %10.1f %10.3f %10.1f %10.2f %7s %8s %12.1f %14.1f\n", k.name, r.name, res.threads, res.frames_per_s, res.mpix_per_s, res.cycles_per_pixel,
+                        res.bytes_per_pixel, res.gb_per_s, (res.stream) ? "nt" : "cached", (res.in_place) ? "in place" : "new", res.scratch_bytes / 1024.0, res.old_arena_bytes / 1024.0);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    if (json)
+    {
+        printf("[\n");
+
+        for (size_t i{ 0 }; i < results.size(); ++i)
+        {
+            const result& res{ results[i] };
+            printf("  { \"kernel\": \"%s\", \"isa\": \"%s\", \"filter\": \"%s\", \"bits\": %d, \"resolution\": \"%s\", \"width\": %d, \"height\": %d, "
+                "\"threads\": %d, \"frames_per_s\": %.3f, \"mpix_per_s\": %.3f, \"cycles_per_pixel\": %.4f, \"bytes_per_pixel\": %.1f, \"gb_per_s\": %.3f, \"stream\": %s, \"in_place\": %s, \"scratch_bytes\": %zu, \"old_arena_bytes\": %zu, \"instances\": %d, \"passes\": %d, \"output\": %d }%s\n",
+                res.k->name, res.k->isa, (res.k->filter == 3) ? "sbrStack" : ((res.k->filter == 2) ? "sbrH" : ((res.k->filter) ? "sbr" : "sbrV")), res.k->bits, res.r->name, res.r->width, res.r->height,
+                res.threads, res.frames_per_s, res.mpix_per_s, res.cycles_per_pixel, res.bytes_per_pixel, res.gb_per_s, (res.stream) ? "true" : "false", (res.in_place) ? "true" : "false", res.scratch_bytes, res.old_arena_bytes, o.instances, o.passes, o.output, (i + 1 < results.size()) ? "," : "");
+        }
+
+        printf("]\n");
+    }
+
+    return 0;
+}
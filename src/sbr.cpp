@@ -1,129 +1,305 @@
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <new>
+#include <sstream>
+#include <tuple>
+#include <type_traits>
+
 #include "sbr.h"
 
-template <typename T, int c>
-static void vertical_blur_c(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
+// Idle blocks are kept up to this many bytes in total; a block returned beyond it is freed.
+static constexpr size_t scratch_capacity{ 64 * 1024 * 1024 };
+
+scratch_pool& scratch_pool::shared()
+{
+    static scratch_pool pool;
+    return pool;
+}
+
+scratch_pool::~scratch_pool()
 {
-    const T* srcp{ reinterpret_cast<const T*>(srcp_) };
-    T* __restrict dstp{ reinterpret_cast<T*>(dstp_) };
+    for (const auto& b : idle)
+        operator delete(b.second, std::align_val_t{ 64 });
+}
 
-    for (int y{ 0 }; y < height; ++y)
+void* scratch_pool::acquire(size_t& size)
+{
     {
-        const T* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const T* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
+        std::lock_guard<std::mutex> lock(mutex);
 
-        for (int x{ 0 }; x < width; ++x)
-            dstp[x] = (srcpp[x] + (srcp[x] << 1) + srcpn[x] + c) >> 2;
+        // The smallest idle block that fits, unless it is so much larger that a bigger request could use it better.
+        const auto it{ idle.lower_bound(size) };
 
-        srcp += src_pitch;
-        dstp += dst_pitch;
+        if (it != idle.end() && it->first <= size * 4)
+        {
+            void* p{ it->second };
+            size = it->first;
+            idle_size -= size;
+            idle.erase(it);
+            return p;
+        }
+    }
+
+    try { return operator new(size, std::align_val_t{ 64 }); }
+    catch (const std::bad_alloc&)
+    {
+        // Under memory pressure the idle blocks are handed back before giving up.
+        std::multimap<size_t, void*> blocks;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.swap(idle);
+            idle_size = 0;
+        }
+
+        for (const auto& b : blocks)
+            operator delete(b.second, std::align_val_t{ 64 });
+
+        return operator new(size, std::align_val_t{ 64 });
     }
 }
 
-template <typename T>
-static void blur_c(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
+void scratch_pool::release(void* p, size_t size) noexcept
 {
-    const T* srcp{ reinterpret_cast<const T*>(srcp_) };
-    T* __restrict dstp{ reinterpret_cast<T*>(dstp_) };
-
-    for (int y{ 0 }; y < height; ++y)
     {
-        const T* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const T* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
+        std::lock_guard<std::mutex> lock(mutex);
 
-        dstp[0] = srcp[0];
+        if (idle_size + size <= scratch_capacity)
+        {
+            idle.emplace(size, p);
+            idle_size += size;
+            return;
+        }
+    }
 
-        for (int x{ 1 }; x < width - 1; x += 1)
-            dstp[x] = (srcpp[x - 1] + srcpp[x + 1] + srcpn[x - 1] + srcpn[x + 1] + ((srcpp[x] + srcp[x - 1] + srcp[x + 1] + srcpn[x]) << 1) + (srcp[x] << 2) + 8) >> 4;
+    operator delete(p, std::align_val_t{ 64 });
+}
 
-        dstp[width - 1] = srcp[width - 1];
+thread_pool::thread_pool(int threads)
+    : job(nullptr), generation(0), pending(0), stop(false)
+{
+    for (int i{ 1 }; i < threads; ++i)
+        workers.emplace_back(&thread_pool::worker, this, i);
+}
 
-        srcp += src_pitch;
-        dstp += dst_pitch;
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
     }
+
+    wake.notify_all();
+
+    for (auto& w : workers)
+        w.join();
 }
 
-template <typename T, int p, int h>
-static void mt_makediff_c(void* __restrict dstp_, const void* c1p_, const void* c2p_, int dst_pitch, int c1_pitch, int c2_pitch, int width, int height) noexcept
+void thread_pool::worker(int index)
 {
-    const T* c1p{ reinterpret_cast<const T*>(c1p_) };
-    const T* c2p{ reinterpret_cast<const T*>(c2p_) };
-    T* __restrict dstp{ reinterpret_cast<T*>(dstp_) };
+    uint64_t seen{ 0 };
 
-    for (int y{ 0 }; y < height; ++y)
+    while (true)
     {
-        for (int x{ 0 }; x < width; ++x)
-            dstp[x] = std::max(std::min(c1p[x] - c2p[x] + h, p), 0);
+        const std::function<void(int)>* f;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seen; });
+
+            if (stop)
+                return;
+
+            seen = generation;
+            f = job;
+        }
 
-        dstp += dst_pitch;
-        c1p += c1_pitch;
-        c2p += c2_pitch;
+        (*f)(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (--pending == 0)
+                done.notify_one();
+        }
     }
 }
 
-template <typename T, int c, int p, int h, int name>
-static void sbr_c(void* __restrict dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept
+void thread_pool::run(const std::function<void(int)>& f)
+{
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &f;
+        pending = static_cast<int>(workers.size());
+        ++generation;
+    }
+
+    wake.notify_all();
+    f(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return pending == 0; });
+}
+
+// isa: 0 C, 1 SSE2, 2 AVX2, 3 AVX512, 4 AVX512 VNNI (8-bit only), 5 AVX512VL at 256-bit (the values of opt).
+template <typename T, int name>
+static sbr_kernel get_kernel(int isa) noexcept
 {
-    if constexpr (name == 0)
+    if constexpr (std::is_same_v<T, float>)
+    {
+        switch (isa)
+        {
+            case 5: return sbr_avx512vl_32<name>;
+            case 4:
+            case 3: return sbr_avx512_32<name>;
+            case 2: return sbr_avx2_32<name>;
+            case 1: return sbr_sse2_32<name>;
+            default: return sbr_c<T, name>;
+        }
+    }
+    else if constexpr (sizeof(T) == 1)
     {
-        vertical_blur_c<T, c>(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_c<T, p, h>(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        vertical_blur_c<T, c>(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.vblur()
+        switch (isa)
+        {
+            case 5: return sbr_avx512vl_8<name>;
+            case 4: return sbr_avx512vnni_8<name>;
+            case 3: return sbr_avx512_8<name>;
+            case 2: return sbr_avx2_8<name>;
+            case 1: return sbr_sse2_8<name>;
+            default: return sbr_c<T, name>;
+        }
     }
     else
     {
-        blur_c<T>(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_c<T, p, h>(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        blur_c<T>(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.blur()
+        switch (isa)
+        {
+            case 5: return sbr_avx512vl_16<name>;
+            case 4:
+            case 3: return sbr_avx512_16<name>;
+            case 2: return sbr_avx2_16<name>;
+            case 1: return sbr_sse2_16<name>;
+            default: return sbr_c<T, name>;
+        }
     }
+}
+
+// Fastest supported kernel set for one plane size and bit depth, measured once per process on a noise plane.
+template <typename T, int name>
+static int autotune(int bits, int width, int height)
+{
+    // Below AVX2 there is nothing to choose from.
+    if (!isa_supported(2))
+        return (isa_supported(1)) ? 1 : 0;
 
-    const T* srcp{ reinterpret_cast<const T*>(srcp_) };
-    T* __restrict tempp{ reinterpret_cast<T*>(tempp_) };
-    T* __restrict dstp{ reinterpret_cast<T*>(dstp_) };
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, int>, int> cache;
 
-    for (int y{ 0 }; y < height; ++y)
+    // Measurements of concurrent constructors would disturb each other.
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto key{ std::make_tuple(bits, width, height) };
+    const auto it{ cache.find(key) };
+
+    if (it != cache.end())
+        return it->second;
+
+    // A band of the plane ranks the kernels; short runs make many rounds, some of which miss a busy core.
+    const int rows{ std::min(height, 64) };
+    const int pitch{ (width + 64 / static_cast<int>(sizeof(T)) - 1) & ~(64 / static_cast<int>(sizeof(T)) - 1) };
+    std::vector<T> src(static_cast<size_t>(pitch) * rows);
+    // sbrStack writes both of its results.
+    std::vector<T> dst(src.size() * ((name == 3) ? 2 : 1));
+    const int strip{ cache_strip(sizeof(T)) };
+    const scratch temp(pitch * scratch_rows(name) * sizeof(T));
+    void* tempp{ temp.get() };
+
+    uint32_t seed{ 0x9E3779B9 };
+
+    for (T& x : src)
     {
-        for (int x{ 0 }; x < width; ++x)
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        if constexpr (std::is_same_v<T, float>)
+            x = static_cast<float>(seed >> 8) * (1.0f / 16777216.0f);
+        else
+            x = static_cast<T>(seed & ((1 << bits) - 1));
+    }
+
+    struct candidate
+    {
+        int isa;
+        sbr_kernel kernel;
+        double time;
+    };
+
+    std::vector<candidate> candidates;
+
+    for (int isa{ 1 }; isa <= 5; ++isa)
+    {
+        // A tier without kernels of its own for this depth runs the ones of another tier.
+        const sbr_kernel kernel{ get_kernel<T, name>(isa) };
+
+        if (isa_supported(isa) && std::none_of(candidates.begin(), candidates.end(), [&](const candidate& c) { return c.kernel == kernel; }))
+            candidates.push_back({ isa, kernel, 1e30 });
+    }
+
+    // The candidates take turns and the best run of each is compared; the first round warms the caches and the clock.
+    double total{ 0.0 };
+
+    for (int round{ 0 }; round < 6 || (total < 0.005 * candidates.size() && round < 2000); ++round)
+    {
+        for (candidate& c : candidates)
         {
-            int t{ dstp[x] - tempp[x] };
-            int t2{ dstp[x] - h };
-            if (t * t2 < 0)
-                dstp[x] = srcp[x];
-            else
+            const auto start{ std::chrono::steady_clock::now() };
+            c.kernel(dst.data(), tempp, src.data(), pitch, pitch, pitch, width, rows, 0, rows, bits, strip, false, 0);
+            const double t{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+            if (round > 0)
             {
-                if (std::abs(t) < std::abs(t2))
-                    dstp[x] = srcp[x] - t;
-                else
-                    dstp[x] = srcp[x] - dstp[x] + h;
+                c.time = std::min(c.time, t);
+                total += t;
             }
         }
-
-        dstp += dst_pitch;
-        srcp += src_pitch;
-        tempp += temp_pitch;
     }
+
+    const int best_isa{ std::min_element(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) { return a.time < b.time; })->isa };
+
+    cache.emplace(key, best_isa);
+    return best_isa;
 }
 
 template <typename T>
-sbr<T>::sbr(PClip child, int y, int u, int v, int opt, std::string name, IScriptEnvironment* env)
-    : GenericVideoFilter(child), process{ 1, 1, 1 }, v8(true)
+sbr<T>::sbr(PClip child, int y, int u, int v, int opt, int threads, float stream, const char* mode, int passes, int output, std::string name, IScriptEnvironment* env)
+    : GenericVideoFilter(child), process{ 2, 2, 2 }, opt(opt), threads(threads), passes(passes), output(output)
 {
     if (!vi.IsPlanar())
         env->ThrowError("%s: only planar input is supported!", name.c_str());
     if (vi.IsRGB())
         env->ThrowError("%s: only YUV input is supported!", name.c_str());
-    if (opt < -1 || opt > 3)
-        env->ThrowError("%s: opt must be between -1..3.", name.c_str());
-
-    const bool avx512{ !!(env->GetCPUFlags() & CPUF_AVX512F) };
-    const bool avx2{ !!(env->GetCPUFlags() & CPUF_AVX2) };
-    const bool sse2{ !!(env->GetCPUFlags() & CPUF_SSE2) };
-
-    if (!avx512 && opt == 3)
-        env->ThrowError("%s: opt=3 requires AVX512F.", name.c_str());
-    if (!avx2 && opt == 2)
-        env->ThrowError("%s: opt=2 requires AVX2.", name.c_str());
-    if (!sse2 && opt == 1)
-        env->ThrowError("%s: opt=1 requires SSE2.", name.c_str());
+    if (opt < -1 || opt > 5)
+        env->ThrowError("%s: opt must be between -1..5.", name.c_str());
+    if (threads < 0)
+        env->ThrowError("%s: threads must be greater than or equal to 0.", name.c_str());
+    if (passes < 1)
+        env->ThrowError("%s: passes must be greater than or equal to 1.", name.c_str());
+    if (output < 0 || output > 2)
+        env->ThrowError("%s: output must be between 0..2.", name.c_str());
+    // The last pass only sees the output of the pass before, not the source.
+    if (output > 0 && passes > 1)
+        env->ThrowError("%s: output=%d requires passes=1.", name.c_str(), output);
+
+    static const char* const requirements[]{ "", "SSE2", "AVX2 and FMA3", "AVX512F, AVX512BW, AVX512DQ, AVX512VL and FMA3",
+        "AVX512F, AVX512BW, AVX512DQ, AVX512VL, AVX512 VNNI, AVX512 VBMI and FMA3", "AVX512F, AVX512BW, AVX512DQ, AVX512VL and FMA3" };
+
+    if (opt > 0 && !isa_supported(opt))
+        env->ThrowError("%s: opt=%d requires %s.", name.c_str(), opt, requirements[opt]);
 
     const int planecount{ std::min(vi.NumComponents(), 3) };
     const int planes[3]{ y, u, v };
@@ -137,135 +313,322 @@ sbr<T>::sbr(PClip child, int y, int u, int v, int opt, std::string name, IScript
             case 1: process[i] = 1; break;
             default: env->ThrowError("%s: y/u/v must be between 1..3.", name.c_str());
         }
+
+        blur[i] = (name == "sbrV") ? 0 : ((name == "sbrH") ? 2 : ((name == "sbrStack") ? 3 : 1));
     }
 
-    if ((avx512 && opt < 0) || opt == 3)
-    {
-        pb_pitch = (vi.width + 63) & ~63;
+    // sbrStack and output=2 return frames of twice the height, with two results for every plane.
+    stacked = name == "sbrStack" || output == 2;
 
-        if (sizeof(T) == 1)
-            sbr_ = (name == "sbrV") ? sbr_avx512_8<0> : sbr_avx512_8<1>;
-        else
-        {
-            switch (vi.BitsPerComponent())
-            {
-                case 10: sbr_ = (name == "sbrV") ? sbr_avx512_16<3, 512, 0x200200, 0> : sbr_avx512_16<3, 512, 0x200200, 1>; break;
-                case 12: sbr_ = (name == "sbrV") ? sbr_avx512_16<4, 2048, 0x800800, 0 > : sbr_avx512_16<4, 2048, 0x800800, 1>; break;
-                case 14: sbr_ = (name == "sbrV") ? sbr_avx512_16<16, 8192, 0x20002000, 0> : sbr_avx512_16<16, 8192, 0x20002000, 1>; break;
-                default: sbr_ = (name == "sbrV") ? sbr_avx512_16<64, 32768, 0x80008000, 0> : sbr_avx512_16<64, 32768, 0x80008000, 1>; break;
-            }
-        }
-    }
-    else if ((avx2 && opt < 0) || opt == 2)
+    if (stacked)
+        vi.height *= 2;
+
+    // mode replaces y, u and v with a blur per plane; planes after the last entry repeat it.
+    if (mode)
     {
-        pb_pitch = (vi.width + 31) & ~31;
+        // In the order of the values of y/u/v, then the blur (the kernel name) for the processed ones.
+        static const char* const modes[]{ "off", "copy", "sbrV", "sbr", "sbrH" };
 
-        if (sizeof(T) == 1)
-            sbr_ = (name == "sbrV") ? sbr_avx2_8<0> : sbr_avx2_8<1>;
-        else
+        std::string list{ mode };
+        std::replace(list.begin(), list.end(), ',', ' ');
+        std::istringstream entries(list);
+        std::string entry;
+        int i{ 0 };
+
+        for (; entries >> entry; ++i)
         {
-            switch (vi.BitsPerComponent())
-            {
-                case 10: sbr_ = (name == "sbrV") ? sbr_avx2_16<3, 512, 0x200200, 0> : sbr_avx2_16<3, 512, 0x200200, 1>; break;
-                case 12: sbr_ = (name == "sbrV") ? sbr_avx2_16<4, 2048, 0x800800, 0> : sbr_avx2_16<4, 2048, 0x800800, 1>; break;
-                case 14: sbr_ = (name == "sbrV") ? sbr_avx2_16<16, 8192, 0x20002000, 0> : sbr_avx2_16<16, 8192, 0x20002000, 1>; break;
-                default: sbr_ = (name == "sbrV") ? sbr_avx2_16<64, 32768, 0x80008000, 0> : sbr_avx2_16<64, 32768, 0x80008000, 1>; break;
-            }
+            if (i == planecount)
+                env->ThrowError("%s: mode has more entries than the clip has planes.", name.c_str());
+
+            const auto it{ std::find_if(std::begin(modes), std::end(modes), [&](const char* m)
+                {
+                    return entry.size() == strlen(m) && std::equal(entry.begin(), entry.end(), m, [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); });
+                }) };
+
+            if (it == std::end(modes))
+                env->ThrowError("%s: mode must list off, copy, sbr, sbrV or sbrH per plane.", name.c_str());
+
+            const int m{ static_cast<int>(it - std::begin(modes)) };
+            process[i] = std::min(m + 1, 3);
+            blur[i] = std::max(m - 2, 0);
         }
-    }
-    else if ((sse2 && opt < 0) || opt == 1)
-    {
-        pb_pitch = (vi.width + 15) & ~15;
 
-        if (sizeof(T) == 1)
-            sbr_ = (name == "sbrV") ? sbr_sse2_8<0> : sbr_sse2_8<1>;
-        else
+        if (i == 0)
+            env->ThrowError("%s: mode must list off, copy, sbr, sbrV or sbrH per plane.", name.c_str());
+
+        for (; i < planecount; ++i)
         {
-            switch (vi.BitsPerComponent())
-            {
-                case 10: sbr_ = (name == "sbrV") ? sbr_sse2_16<3, 512, 0x200200, 0> : sbr_sse2_16<3, 512, 0x200200, 1>; break;
-                case 12: sbr_ = (name == "sbrV") ? sbr_sse2_16<4, 2048, 0x800800, 0> : sbr_sse2_16<4, 2048, 0x800800, 1>; break;
-                case 14: sbr_ = (name == "sbrV") ? sbr_sse2_16<16, 8192, 0x20002000, 0> : sbr_sse2_16<16, 8192, 0x20002000, 1>; break;
-                default: sbr_ = (name == "sbrV") ? sbr_sse2_16<64, 32768, 0x80008000, 0> : sbr_sse2_16<64, 32768, 0x80008000, 1>; break;
-            }
+            process[i] = process[i - 1];
+            blur[i] = blur[i - 1];
         }
     }
-    else
+
+    bits = vi.BitsPerComponent();
+    strip = cache_strip(sizeof(T));
+
+    // A fraction of the last-level cache (see cache_llc()). A negative fraction never streams.
+    stream_size = (stream < 0.0f) ? -1 : static_cast<int64_t>(static_cast<double>(stream) * cache_llc());
+
+    if (threads == 0)
+        this->threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+    // NewVideoFrameP() came with interface 8, told by the size of AVS_Linkage (CheckVersion() throws on old hosts).
+    v8 = AVS_linkage->Size >= static_cast<int>(offsetof(AVS_Linkage, setProperties) + sizeof(AVS_linkage->setProperties));
+}
+
+// The kernel choice and the workers wait for the first frame, so instances that never deliver one cost nothing.
+template <typename T>
+void sbr<T>::setup()
+{
+    // Every processed plane gets the kernel of its blur, tuned on its own size (the tuning is shared by U and V).
+    const int height{ (stacked) ? vi.height / 2 : vi.height };
+
+    for (int pid{ 0 }; pid < 3; ++pid)
     {
-        pb_pitch = (vi.width + 15) & ~15;
+        if (process[pid] != 3)
+            continue;
 
-        if (sizeof(T) == 1)
-            sbr_ = (name == "sbrV") ? sbr_c<T, 2, 255, 128, 0> : sbr_c<T, 8, 255, 128, 1>;
-        else
+        const int plane_width{ (pid) ? vi.width >> vi.GetPlaneWidthSubsampling(PLANAR_U) : vi.width };
+        const int plane_height{ (pid) ? height >> vi.GetPlaneHeightSubsampling(PLANAR_U) : height };
+        int isa{ opt };
+
+        switch (blur[pid])
         {
-            switch (vi.BitsPerComponent())
-            {
-                case 10: sbr_ = (name == "sbrV") ? sbr_c<T, 3, 1023, 512, 0> : sbr_c<T, 3, 1023, 512, 1>; break;
-                case 12: sbr_ = (name == "sbrV") ? sbr_c<T, 4, 4095, 2048, 0> : sbr_c<T, 4, 4095, 2048, 1>; break;
-                case 14: sbr_ = (name == "sbrV") ? sbr_c<T, 16, 16383, 8192, 0> : sbr_c<T, 16, 16383, 8192, 1>; break;
-                default: sbr_ = (name == "sbrV") ? sbr_c<T, 64, 65535, 32768, 0> : sbr_c<T, 64, 65535, 32768, 1>; break;
-            }
+            case 0:
+                isa = (isa < 0) ? autotune<T, 0>(bits, plane_width, plane_height) : isa;
+                sbr_[pid] = get_kernel<T, 0>(isa);
+                break;
+            case 2:
+                isa = (isa < 0) ? autotune<T, 2>(bits, plane_width, plane_height) : isa;
+                sbr_[pid] = get_kernel<T, 2>(isa);
+                break;
+            case 3:
+                isa = (isa < 0) ? autotune<T, 3>(bits, plane_width, plane_height) : isa;
+                sbr_[pid] = get_kernel<T, 3>(isa);
+                break;
+            default:
+                isa = (isa < 0) ? autotune<T, 1>(bits, plane_width, plane_height) : isa;
+                sbr_[pid] = get_kernel<T, 1>(isa);
+                break;
         }
     }
 
-    buffer = std::make_unique<T[]>(vi.height * pb_pitch * 2 * sizeof(T));
-
-    try { env->CheckVersion(8); }
-    catch (const AvisynthError&) { v8 = false; }
+    if (threads > 1)
+        pool = std::make_unique<thread_pool>(threads);
 }
 
 template <typename T>
 PVideoFrame __stdcall sbr<T>::GetFrame(int n, IScriptEnvironment* env)
 {
     PVideoFrame src{ child->GetFrame(n, env) };
-    PVideoFrame dst{ (v8) ? env->NewVideoFrameP(vi, &src) : env->NewVideoFrame(vi) };
+
+    // Copied planes are copied only into a new frame: without a processed plane the source is returned,
+    // and a writable source is filtered in place where sbr_in_place() allows.
+    if (!stacked && output == 0 && std::all_of(process, process + 3, [](int p) { return p == 2; }))
+        return src;
+
+    std::call_once(ready, [this] { setup(); });
+
+    const bool in_place{ !pool && !stacked && src->IsWritable() && sbr_in_place(vi.width, strip, passes, output) };
+    PVideoFrame dst{ (in_place) ? src : (v8) ? env->NewVideoFrameP(vi, &src) : env->NewVideoFrame(vi) };
+
+    // GetWritePtr() needs the only reference.
+    if (in_place)
+        src = nullptr;
+
+    const PVideoFrame& in{ (in_place) ? dst : src };
 
     const int planes[3]{ PLANAR_Y, PLANAR_U, PLANAR_V };
 
+    // The difference of a copied plane is that of MakeDiff: the half of the bit depth, 0 for float.
+    const auto fill_half{ [&](uint8_t* p, int pitch, int row_size, int rows)
+        {
+            for (int y{ 0 }; y < rows; ++y)
+            {
+                T* row{ reinterpret_cast<T*>(p + static_cast<size_t>(y) * pitch) };
+
+                if constexpr (std::is_same_v<T, float>)
+                    std::fill_n(row, row_size / sizeof(T), 0.0f);
+                else
+                    std::fill_n(row, row_size / sizeof(T), static_cast<T>(1 << (bits - 1)));
+            }
+        } };
+
+    const uint8_t* srcp[3];
+    uint8_t* dstp[3];
+    int src_pitch[3];
+    int dst_pitch[3];
+    int temp_pitch[3];
+    int pass_band[3];
+    int width[3];
+    int height[3];
+    bool stream[3];
+    size_t temp_size{ 0 };
+    int rows{ 0 };
+
     for (int pid{ 0 }; pid < 3; ++pid)
     {
-        const int height{ src->GetHeight(planes[pid]) };
-        const uint8_t* srcp{ src->GetReadPtr(planes[pid]) };
-        uint8_t* dstp{ dst->GetWritePtr(planes[pid]) };
+        height[pid] = in->GetHeight(planes[pid]);
+        dstp[pid] = dst->GetWritePtr(planes[pid]);
+        srcp[pid] = (in_place) ? dstp[pid] : in->GetReadPtr(planes[pid]);
 
         if (process[pid] == 2)
-            env->BitBlt(dstp, dst->GetPitch(planes[pid]), srcp, src->GetPitch(planes[pid]), src->GetRowSize(planes[pid]), height);
-        else
         {
-            const size_t src_pitch{ src->GetPitch(planes[pid]) / sizeof(T) };
-            const size_t dst_pitch{ dst->GetPitch(planes[pid]) / sizeof(T) };
-            const size_t width{ src->GetRowSize(planes[pid]) / sizeof(T) };
+            uint8_t* const lower{ dstp[pid] + static_cast<size_t>(height[pid]) * dst->GetPitch(planes[pid]) };
+
+            if (output == 1)
+                fill_half(dstp[pid], dst->GetPitch(planes[pid]), in->GetRowSize(planes[pid]), height[pid]);
+            else if (!in_place)
+                env->BitBlt(dstp[pid], dst->GetPitch(planes[pid]), srcp[pid], in->GetPitch(planes[pid]), in->GetRowSize(planes[pid]), height[pid]);
 
-            sbr_(dstp, buffer.get(), srcp, dst_pitch, pb_pitch, src_pitch, width, height);
+            if (output == 2)
+                fill_half(lower, dst->GetPitch(planes[pid]), in->GetRowSize(planes[pid]), height[pid]);
+            else if (stacked)
+                env->BitBlt(lower, dst->GetPitch(planes[pid]), srcp[pid], in->GetPitch(planes[pid]), in->GetRowSize(planes[pid]), height[pid]);
+        }
+        // Planes that return garbage (off) are left as they are.
+        else if (process[pid] == 3)
+        {
+            src_pitch[pid] = in->GetPitch(planes[pid]) / sizeof(T);
+            dst_pitch[pid] = dst->GetPitch(planes[pid]) / sizeof(T);
+            width[pid] = in->GetRowSize(planes[pid]) / sizeof(T);
+            // The kernels stay inside the width, so the rows are only rounded up to keep them 64-byte aligned.
+            temp_pitch[pid] = (width[pid] + 64 / sizeof(T) - 1) & ~(64 / sizeof(T) - 1);
+            // More than one pass runs in bands whose intermediate rows fit in the cache, with two buffers for them.
+            pass_band[pid] = cache_band(temp_pitch[pid] * sizeof(T));
+            temp_size = std::max(temp_size, temp_pitch[pid] * scratch_rows(blur[pid], passes, pass_band[pid]) * sizeof(T));
+            rows += height[pid];
+            // Output planes larger than the cache share are streamed, but never in place.
+            stream[pid] = !in_place && stream_size >= 0 && static_cast<int64_t>(width[pid]) * dst->GetHeight(planes[pid]) * static_cast<int64_t>(sizeof(T)) > stream_size;
         }
     }
 
+    // The scratch is borrowed from the shared pool only while the kernels run.
+    if (!pool)
+    {
+        const scratch temp(temp_size);
+
+        for (int pid{ 0 }; pid < 3; ++pid)
+        {
+            if (process[pid] == 3)
+                sbr_passes<T>(sbr_[pid], passes, pass_band[pid], blur[pid], dstp[pid], temp.get(), srcp[pid], dst_pitch[pid], temp_pitch[pid], src_pitch[pid], width[pid], height[pid], 0, height[pid], bits, strip, stream[pid], output);
+        }
+
+        return dst;
+    }
+
+    // The bands of all processed planes share one queue, so Y, U and V are balanced together.
+    struct band
+    {
+        int pid;
+        int y_begin;
+        int y_end;
+    };
+
+    // Four bands per thread, each at least 16 rows per pass so the recomputed halo rows stay cheap.
+    const int band_height{ std::max((rows + pool->size() * 4 - 1) / (pool->size() * 4), 16 * passes) };
+    std::vector<band> bands;
+
+    for (int pid{ 0 }; pid < 3; ++pid)
+    {
+        if (process[pid] != 3)
+            continue;
+
+        for (int y{ 0 }; y < height[pid]; y += band_height)
+            bands.push_back({ pid, y, std::min(y + band_height, height[pid]) });
+    }
+
+    // The scratch of every thread is borrowed up front, so a failed allocation throws on the calling thread.
+    std::vector<std::unique_ptr<scratch>> temps(std::min(bands.size(), static_cast<size_t>(pool->size())));
+
+    for (auto& t : temps)
+        t = std::make_unique<scratch>(temp_size);
+
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> used{ 0 };
+
+    pool->run([&](int)
+        {
+            size_t i{ next++ };
+
+            if (i >= bands.size())
+                return;
+
+            void* const temp{ temps[used++]->get() };
+
+            for (; i < bands.size(); i = next++)
+            {
+                const band& b{ bands[i] };
+                sbr_passes<T>(sbr_[b.pid], passes, pass_band[b.pid], blur[b.pid], dstp[b.pid], temp, srcp[b.pid], dst_pitch[b.pid], temp_pitch[b.pid], src_pitch[b.pid], width[b.pid], height[b.pid], b.y_begin, b.y_end, bits, strip, stream[b.pid], output);
+            }
+        });
+
     return dst;
 }
 
 AVSValue __cdecl Create_sbrV(AVSValue args, void*, IScriptEnvironment* env)
 {
-    enum { CLIP, Y, U, V, OPT };
+    enum { CLIP, Y, U, V, OPT, THREADS, STREAM, MODE, PASSES, OUTPUT };
     PClip clip = args[CLIP].AsClip();
 
+    // mode replaces y, u and v, so giving both would silently drop the planes.
+    if (args[MODE].Defined() && (args[Y].Defined() || args[U].Defined() || args[V].Defined()))
+        env->ThrowError("sbrV: mode and y/u/v are mutually exclusive.");
+
     switch (clip->GetVideoInfo().ComponentSize())
     {
-        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), "sbrV", env);
-        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), "sbrV", env);
-        default: env->ThrowError("sbrV: only 8..16-bit input is supported!");
+        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrV", env);
+        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrV", env);
+        case 4: return new sbr<float>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrV", env);
+        default: env->ThrowError("sbrV: only 8..16-bit integer and 32-bit float input is supported!");
     }
 }
 
 AVSValue __cdecl Create_sbr(AVSValue args, void*, IScriptEnvironment* env)
 {
-    enum { CLIP, Y, U, V, OPT };
+    enum { CLIP, Y, U, V, OPT, THREADS, STREAM, MODE, PASSES, OUTPUT };
+    PClip clip = args[CLIP].AsClip();
+
+    if (args[MODE].Defined() && (args[Y].Defined() || args[U].Defined() || args[V].Defined()))
+        env->ThrowError("sbr: mode and y/u/v are mutually exclusive.");
+
+    switch (clip->GetVideoInfo().ComponentSize())
+    {
+        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbr", env);
+        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbr", env);
+        case 4: return new sbr<float>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbr", env);
+        default: env->ThrowError("sbr: only 8..16-bit integer and 32-bit float input is supported!");
+    }
+}
+
+AVSValue __cdecl Create_sbrH(AVSValue args, void*, IScriptEnvironment* env)
+{
+    enum { CLIP, Y, U, V, OPT, THREADS, STREAM, MODE, PASSES, OUTPUT };
+    PClip clip = args[CLIP].AsClip();
+
+    if (args[MODE].Defined() && (args[Y].Defined() || args[U].Defined() || args[V].Defined()))
+        env->ThrowError("sbrH: mode and y/u/v are mutually exclusive.");
+
+    switch (clip->GetVideoInfo().ComponentSize())
+    {
+        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrH", env);
+        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrH", env);
+        case 4: return new sbr<float>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), args[MODE].AsString(nullptr), args[PASSES].AsInt(1), args[OUTPUT].AsInt(0), "sbrH", env);
+        default: env->ThrowError("sbrH: only 8..16-bit integer and 32-bit float input is supported!");
+    }
+}
+
+AVSValue __cdecl Create_sbrStack(AVSValue args, void*, IScriptEnvironment* env)
+{
+    enum { CLIP, Y, U, V, OPT, THREADS, STREAM };
     PClip clip = args[CLIP].AsClip();
 
     switch (clip->GetVideoInfo().ComponentSize())
     {
-        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), "sbr", env);
-        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), "sbr", env);
-        default: env->ThrowError("sbrV: only 8..16-bit input is supported!");
+        case 1: return new sbr<uint8_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), nullptr, 1, 0, "sbrStack", env);
+        case 2: return new sbr<uint16_t>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), nullptr, 1, 0, "sbrStack", env);
+        case 4: return new sbr<float>(clip, args[Y].AsInt(3), args[U].AsInt(2), args[V].AsInt(2), args[OPT].AsInt(-1), args[THREADS].AsInt(1), args[STREAM].AsFloatf(0.5f), nullptr, 1, 0, "sbrStack", env);
+        default: env->ThrowError("sbrStack: only 8..16-bit integer and 32-bit float input is supported!");
     }
 }
 
@@ -275,7 +638,9 @@ extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScri
 {
     AVS_linkage = vectors;
 
-    env->AddFunction("sbrV", "c[y]i[u]i[v]i[opt]i", Create_sbrV, 0);
-    env->AddFunction("sbr", "c[y]i[u]i[v]i[opt]i", Create_sbr, 0);
+    env->AddFunction("sbrV", "c[y]i[u]i[v]i[opt]i[threads]i[stream]f[mode]s[passes]i[output]i", Create_sbrV, 0);
+    env->AddFunction("sbr", "c[y]i[u]i[v]i[opt]i[threads]i[stream]f[mode]s[passes]i[output]i", Create_sbr, 0);
+    env->AddFunction("sbrH", "c[y]i[u]i[v]i[opt]i[threads]i[stream]f[mode]s[passes]i[output]i", Create_sbrH, 0);
+    env->AddFunction("sbrStack", "c[y]i[u]i[v]i[opt]i[threads]i[stream]f", Create_sbrStack, 0);
     return "sbrVS?";
 }
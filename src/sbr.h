@@ -1,41 +1,102 @@
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "avisynth.h"
+#include "sbr_kernels.h"
+
+// Persistent workers for intra-frame threading. run() calls job(index) on every thread, the caller being index 0.
+class thread_pool
+{
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job;
+    uint64_t generation;
+    int pending;
+    bool stop;
+
+    void worker(int index);
+
+public:
+    explicit thread_pool(int threads);
+    ~thread_pool();
+
+    int size() const noexcept { return static_cast<int>(workers.size()) + 1; }
+    void run(const std::function<void(int)>& f);
+};
+
+// Scratch blocks shared by every instance of the process, borrowed only while kernels run.
+// acquire() may return a larger block and updates size then.
+class scratch_pool
+{
+    std::mutex mutex;
+    std::multimap<size_t, void*> idle;
+    size_t idle_size{ 0 };
+
+    scratch_pool() = default;
+
+public:
+    ~scratch_pool();
+
+    static scratch_pool& shared();
+    void* acquire(size_t& size);
+    void release(void* p, size_t size) noexcept;
+};
+
+// A block of the shared pool for the lifetime of the object. Rows stay 64-byte aligned.
+class scratch
+{
+    size_t size;
+    void* p;
+
+public:
+    explicit scratch(size_t size) : size(size), p(scratch_pool::shared().acquire(this->size)) {}
+    ~scratch() { scratch_pool::shared().release(p, size); }
+
+    scratch(const scratch&) = delete;
+    scratch& operator=(const scratch&) = delete;
+
+    void* get() const noexcept { return p; }
+};
 
 template <typename T>
 class sbr : public GenericVideoFilter
 {
     int process[3];
-    int pb_pitch;
-    std::unique_ptr<T[]> buffer;
+    int bits;
+    int strip;
+    int64_t stream_size;
+    int opt;
+    int threads;
+    int blur[3];
+    int passes;
+    int output;
+    bool stacked;
     bool v8;
+    std::once_flag ready;
+    std::unique_ptr<thread_pool> pool;
+
+    sbr_kernel sbr_[3];
 
-    void(*sbr_)(void* dstp, void* tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
+    void setup();
 
 public:
-    sbr(PClip child, int y, int u, int v, int opt, std::string name, IScriptEnvironment* env);
+    sbr(PClip child, int y, int u, int v, int opt, int threads, float stream, const char* mode, int passes, int output, std::string name, IScriptEnvironment* env);
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
 
     int __stdcall SetCacheHints(int cachehints, int frame_range) override
     {
-        return cachehints == CACHE_GET_MTMODE ? MT_MULTI_INSTANCE : 0;
+        return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
     }
 };
-
-template <int name>
-void sbr_sse2_8(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template <int c, int h, uint32_t u, int name>
-void sbr_sse2_16(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-
-template <int name>
-void sbr_avx2_8(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template <int c, int h, uint32_t u, int name>
-void sbr_avx2_16(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-
-template <int name>
-void sbr_avx512_8(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template <int c, int h, uint32_t u, int name>
-void sbr_avx512_16(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
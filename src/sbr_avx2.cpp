@@ -1,415 +1,651 @@
-#include "sbr.h"
-#include "VCL2/vectorclass.h"
+#include "sbr_kernels.h"
+#include "sbr_simd.h"
 
-static void vertical_blur_avx2_8(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
-{
-    const uint8_t* srcp{ reinterpret_cast<const uint8_t*>(srcp_) };
-    uint8_t* __restrict dstp{ reinterpret_cast<uint8_t*>(dstp_) };
+// sbr_avx512vl.cpp builds this file again with AVX512VL; SBR_AVX2 gives the names that either build exports.
+#ifndef SBR_AVX2
+#define SBR_AVX2(name, depth) name##_avx2_##depth
+#endif
 
-    const auto two{ Vec16us(2) };
+// (p + 2 * c + n + 2) >> 2 in byte lanes: pavgb(c, (p + n) >> 1), with (p + n) >> 1 from pavgb(p, n).
+static Vec32uc vertical_blur_avx2_8(const Vec32uc& p, const Vec32uc& c, const Vec32uc& n) noexcept
+{
+    const Vec32uc pn{ _mm256_avg_epu8(p, n) };
+    return _mm256_avg_epu8(c, pn - ((p ^ n) & Vec32uc(1)));
+}
 
-    for (int y{ 0 }; y < height; ++y)
+// The 3x3 blur is separable: the vertical 1-2-1 sums of a row go into sums once, in 16-bit lanes.
+static void vertical_sums_avx2_8(uint16_t* __restrict sums, const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int begin, int end) noexcept
+{
+    for (int x{ begin }; x < end; x += 32)
     {
-        const uint8_t* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const uint8_t* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
+        const int count{ std::min(end - x, Vec32uc::size()) };
+        const auto p{ load_simd<Vec32uc>(srcpp + x, count) };
+        const auto c{ load_simd<Vec32uc>(srcp + x, count) };
+        const auto n{ load_simd<Vec32uc>(srcpn + x, count) };
 
-        for (int x{ 0 }; x < width; x += 32)
-        {
-            const auto p{ Vec32uc().load(srcpp + x) };
-            const auto c{ Vec32uc().load(srcp + x) };
-            const auto n{ Vec32uc().load(srcpn + x) };
+        store_simd(extend_low(p) + (extend_low(c) << 1) + extend_low(n), sums + x, count);
+        store_simd(extend_high(p) + (extend_high(c) << 1) + extend_high(n), sums + x + Vec16us::size(), std::max(count - Vec16us::size(), 0));
+    }
+}
 
-            const auto p_lo{ extend_low(p) };
-            const auto p_hi{ extend_high(p) };
-            const auto c_lo{ extend_low(c) };
-            const auto c_hi{ extend_high(c) };
-            const auto n_lo{ extend_low(n) };
-            const auto n_hi{ extend_high(n) };
+static Vec32uc horizontal_blur_avx2_8(const uint16_t* sums, int count) noexcept
+{
+    // The outer loads reach one lane left and right of the vector, which are still inside the row.
+    const auto result_lo{ (load_simd<Vec16us>(sums - 1, count) + (load_simd<Vec16us>(sums, count) << 1) + load_simd<Vec16us>(sums + 1, count) + Vec16us(8)) >> 4 };
+    sums += Vec16us::size();
+    count = std::max(count - Vec16us::size(), 0);
+    const auto result_hi{ (load_simd<Vec16us>(sums - 1, count) + (load_simd<Vec16us>(sums, count) << 1) + load_simd<Vec16us>(sums + 1, count) + Vec16us(8)) >> 4 };
 
-            auto acc_lo{ c_lo + p_lo };
-            auto acc_hi{ c_hi + p_hi };
+    return compress_saturated(result_lo, result_hi);
+}
 
-            acc_lo = acc_lo + c_lo;
-            acc_hi = acc_hi + c_hi;
+// clamp(c1 - c2 + 128, 0, 255) like mt_makediff, from two saturated differences.
+static Vec32uc makediff_avx2_8(const Vec32uc& c1, const Vec32uc& c2) noexcept
+{
+    return add_saturated(sub_saturated(Vec32uc(128), sub_saturated(c2, c1)), sub_saturated(c1, c2));
+}
 
-            acc_lo = acc_lo + n_lo;
-            acc_hi = acc_hi + n_hi;
+template <int name>
+static void makediff_row_avx2_8(uint8_t* __restrict dstp, const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
+{
+    if constexpr (name == 0)
+    {
+        row_simd<Vec32uc>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec32uc>(srcpp + x, count) };
+                const auto c{ load_simd<Vec32uc>(srcp + x, count) };
+                const auto n{ load_simd<Vec32uc>(srcpn + x, count) };
+
+                return makediff_avx2_8(c, vertical_blur_avx2_8(p, c, n));
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec32uc, false>(dstp, srcp, x_begin, x_end, width, [&](const uint8_t* l, const uint8_t* m, const uint8_t* r, int, int count) noexcept
+            {
+                const auto c{ load_simd<Vec32uc>(m, count) };
 
-            acc_lo = acc_lo + two;
-            acc_hi = acc_hi + two;
+                return makediff_avx2_8(c, vertical_blur_avx2_8(load_simd<Vec32uc>(l, count), c, load_simd<Vec32uc>(r, count)));
+            });
+    }
+    else
+    {
+        uint16_t* sums{ reinterpret_cast<uint16_t*>(sums_) };
+        vertical_sums_avx2_8(sums, srcpp, srcp, srcpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
 
-            acc_lo = acc_lo >> 2;
-            acc_hi = acc_hi >> 2;
+        row_simd<Vec32uc>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec32uc>(srcp + x, count) };
 
-            compress_saturated(acc_lo, acc_hi).store(dstp + x);
-        }
+                return makediff_avx2_8(c, horizontal_blur_avx2_8(sums + x, count));
+            });
 
-        srcp += src_pitch;
-        dstp += dst_pitch;
+        // The blur keeps the edge columns.
+        if (x_begin == 0)
+            dstp[0] = 128;
+        if (x_end == width)
+            dstp[width - 1] = 128;
     }
 }
 
-static void blur_avx2_8(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
+// sbrStack: the rg11D rows of sbr (dstp) and sbrV (dstvp) from one pass of vertical sums.
+static void makediff_stack_row_avx2_8(uint8_t* __restrict dstp, uint8_t* __restrict dstvp, const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
 {
-    const uint8_t* srcp{ reinterpret_cast<const uint8_t*>(srcp_) };
-    uint8_t* __restrict dstp{ reinterpret_cast<uint8_t*>(dstp_) };
+    makediff_row_avx2_8<1>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, sums_);
 
-    for (int y{ 0 }; y < height; ++y)
-    {
-        const uint8_t* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const uint8_t* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
-
-        dstp[0] = srcp[0];
+    const uint16_t* sums{ reinterpret_cast<const uint16_t*>(sums_) };
 
-        for (int x{ 1 }; x < width - 1; x += 32)
+    row_simd<Vec32uc>(dstvp, x_begin, x_end, [&](int x, int count) noexcept
         {
-            const auto a1{ Vec32uc().load(srcpp + x - 1) };
-            const auto a2{ Vec32uc().load(srcpp + x) };
-            const auto a3{ Vec32uc().load(srcpp + x + 1) };
-            const auto a4{ Vec32uc().load(srcp + x - 1) };
-            const auto a5{ Vec32uc().load(srcp + x) };
-            const auto a6{ Vec32uc().load(srcp + x + 1) };
-            const auto a7{ Vec32uc().load(srcpn + x - 1) };
-            const auto a8{ Vec32uc().load(srcpn + x) };
-            const auto a9{ Vec32uc().load(srcpn + x + 1) };
-
-            const auto a1_lo{ extend_low(a1) };
-            const auto a2_lo{ extend_low(a2) };
-            const auto a3_lo{ extend_low(a3) };
-            const auto a4_lo{ extend_low(a4) };
-            const auto a5_lo{ extend_low(a5) };
-            const auto a6_lo{ extend_low(a6) };
-            const auto a7_lo{ extend_low(a7) };
-            const auto a8_lo{ extend_low(a8) };
-            const auto a9_lo{ extend_low(a9) };
-
-            const auto result_lo{ (a1_lo + a3_lo + a7_lo + a9_lo + ((a2_lo + a4_lo + a6_lo + a8_lo) << 1) + (a5_lo << 2) + Vec16us(8)) >> 4 };
-            //
-            const auto a1_hi{ extend_high(a1) };
-            const auto a2_hi{ extend_high(a2) };
-            const auto a3_hi{ extend_high(a3) };
-            const auto a4_hi{ extend_high(a4) };
-            const auto a5_hi{ extend_high(a5) };
-            const auto a6_hi{ extend_high(a6) };
-            const auto a7_hi{ extend_high(a7) };
-            const auto a8_hi{ extend_high(a8) };
-            const auto a9_hi{ extend_high(a9) };
-
-            const auto result_hi{ (a1_hi + a3_hi + a7_hi + a9_hi + ((a2_hi + a4_hi + a6_hi + a8_hi) << 1) + (a5_hi << 2) + Vec16us(8)) >> 4 };
-            //
-            compress_saturated(result_lo, result_hi).store(dstp + x);
-        }
+            const auto c{ load_simd<Vec32uc>(srcp + x, count) };
+            const auto blur_lo{ (load_simd<Vec16us>(sums + x, count) + Vec16us(2)) >> 2 };
+            const auto blur_hi{ (load_simd<Vec16us>(sums + x + Vec16us::size(), std::max(count - Vec16us::size(), 0)) + Vec16us(2)) >> 2 };
 
-        dstp[width - 1] = srcp[width - 1];
-
-        srcp += src_pitch;
-        dstp += dst_pitch;
-    }
+            return makediff_avx2_8(c, compress_saturated(blur_lo, blur_hi));
+        });
 }
 
-static void mt_makediff_avx2_8(void* __restrict dstp_, const void* c1p_, const void* c2p_, int dst_pitch, int c1_pitch, int c2_pitch, int width, int height) noexcept
+// The correction is median(t, t2, 0) with t = dst - temp and t2 = dst - 128. diff returns the correction + 128.
+template <bool diff>
+static Vec32uc select_avx2_8(const Vec32uc& src, const Vec32uc& dst, const Vec32uc& temp) noexcept
 {
-    const uint8_t* c1p{ reinterpret_cast<const uint8_t*>(c1p_) };
-    const uint8_t* c2p{ reinterpret_cast<const uint8_t*>(c2p_) };
-    uint8_t* __restrict dstp{ reinterpret_cast<uint8_t*>(dstp_) };
+    const Vec32c zero{ zero_si256() };
+    const auto v128{ Vec32uc(128) };
 
-    const auto v128{ Vec32uc(0x80808080) };
+    const auto t2{ Vec32c(dst ^ v128) };
+    const auto t{ sub_saturated(t2, Vec32c(temp ^ v128)) };
+    const auto m{ max(min(t, t2), min(max(t, t2), zero)) };
 
-    for (int y{ 0 }; y < height; ++y)
+    // m lies between 0 and t2 and rg11D is clamped, so the byte arithmetic is exact.
+    if constexpr (diff)
+        return Vec32uc(m) ^ v128;
+    else
+        return src - Vec32uc(m);
+}
+
+template <int name, bool stream, bool diff>
+static void final_row_avx2_8(uint8_t* dstp, const uint8_t* srcp, const uint8_t* diffpp, const uint8_t* diffp, const uint8_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
+{
+    if constexpr (name == 0)
     {
-        for (int x{ 0 }; x < width; x += 32)
-        {
-            auto c1{ Vec32uc().load(c1p + x) };
-            auto c2{ Vec32uc().load(c2p + x) };
+        output_row_simd<Vec32uc, stream>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec32uc>(diffpp + x, count) };
+                const auto c{ load_simd<Vec32uc>(diffp + x, count) };
+                const auto n{ load_simd<Vec32uc>(diffpn + x, count) };
+                const auto src{ load_simd<Vec32uc>(srcp + x, count) };
+
+                return select_avx2_8<diff>(src, c, vertical_blur_avx2_8(p, c, n));
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec32uc, stream>(dstp, diffp, x_begin, x_end, width, [&](const uint8_t* l, const uint8_t* m, const uint8_t* r, int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec32uc>(m, count) };
+                const auto src{ load_simd<Vec32uc>(srcp + x, count) };
+
+                return select_avx2_8<diff>(src, c, vertical_blur_avx2_8(load_simd<Vec32uc>(l, count), c, load_simd<Vec32uc>(r, count)));
+            });
+    }
+    else
+    {
+        uint16_t* sums{ reinterpret_cast<uint16_t*>(sums_) };
+        vertical_sums_avx2_8(sums, diffpp, diffp, diffpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
 
-            c1 = c1 - v128;
-            c2 = c2 - v128;
+        // blur() keeps the edge columns, so t is 0 there and the source passes through.
+        const uint8_t last{ (diff) ? static_cast<uint8_t>(128) : srcp[width - 1] };
 
-            auto diff{ c1 - c2 };
-            diff = diff + v128;
-            diff.store(dstp + x);
-        }
+        if (x_begin == 0)
+            dstp[0] = (diff) ? 128 : srcp[0];
+
+        output_row_simd<Vec32uc, stream>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec32uc>(diffp + x, count) };
+                const auto src{ load_simd<Vec32uc>(srcp + x, count) };
 
-        dstp += dst_pitch;
-        c1p += c1_pitch;
-        c2p += c2_pitch;
+                return select_avx2_8<diff>(src, c, horizontal_blur_avx2_8(sums + x, count));
+            });
+
+        if (x_end == width)
+            dstp[width - 1] = last;
     }
 }
 
+template <int name, bool stream>
+static void sbr_avx2_8(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip, int output) noexcept
+{
+    if constexpr (name == 3)
+        sbr_fused_stack<uint8_t>(makediff_stack_row_avx2_8, final_row_avx2_8<1, stream, false>, final_row_avx2_8<0, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 0)
+        sbr_fused<uint8_t>(makediff_row_avx2_8<name>, final_row_avx2_8<name, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 1)
+        sbr_fused<uint8_t>(makediff_row_avx2_8<name>, final_row_avx2_8<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else
+        sbr_fused_both<uint8_t>(makediff_row_avx2_8<name>, final_row_avx2_8<name, stream, false>, final_row_avx2_8<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+}
+
 template <int name>
-void sbr_avx2_8(void* __restrict dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept
+void SBR_AVX2(sbr, 8)(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int, int strip, bool stream, int output) noexcept
 {
-    if constexpr (name == 0)
+    if (stream)
     {
-        vertical_blur_avx2_8(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_avx2_8(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        vertical_blur_avx2_8(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.vblur()
+        sbr_avx2_8<name, true>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+        // Non-temporal stores are weakly ordered.
+        _mm_sfence();
     }
     else
+        sbr_avx2_8<name, false>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+}
+
+template void SBR_AVX2(sbr, 8)<0>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 8)<1>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 8)<2>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 8)<3>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+// 16-bit lanes throughout; only the blur sums of 13..16-bit input are widened (wide).
+namespace
+{
+    struct depth_avx2_16
     {
-        blur_avx2_8(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_avx2_8(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        blur_avx2_8(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.blur()
-    }
+        Vec16us rounding; // of the vertical blur
+        Vec16us peak;
+        Vec16us half;
 
-    const uint8_t* srcp{ reinterpret_cast<const uint8_t*>(srcp_) };
-    uint8_t* __restrict tempp{ reinterpret_cast<uint8_t*>(tempp_) };
-    uint8_t* __restrict dstp{ reinterpret_cast<uint8_t*>(dstp_) };
+        explicit depth_avx2_16(int bits) noexcept
+            : rounding(static_cast<uint16_t>(vertical_rounding(bits))), peak(static_cast<uint16_t>((1 << bits) - 1)), half(static_cast<uint16_t>(1 << (bits - 1))) {}
+    };
+}
 
-    const Vec16us zero{ zero_si256() };
-    const auto v128{ Vec16us(128) };
+template <bool wide>
+static Vec16us vertical_blur_avx2_16(const Vec16us& p, const Vec16us& c, const Vec16us& n, const depth_avx2_16& d) noexcept
+{
+    // Capped at the peak like the C path.
+    if constexpr (!wide)
+        return min((p + (c << 1) + n + d.rounding) >> 2, d.peak);
+    else
+    {
+        const auto acc_lo{ (extend_low(p) + (extend_low(c) << 1) + extend_low(n) + extend_low(d.rounding)) >> 2 };
+        const auto acc_hi{ (extend_high(p) + (extend_high(c) << 1) + extend_high(n) + extend_high(d.rounding)) >> 2 };
+
+        return min(compress_saturated(acc_lo, acc_hi), d.peak);
+    }
+}
 
-    for (int y{ 0 }; y < height; ++y)
+// Vertical 1-2-1 sums for the separable 3x3 blur, in 16-bit lanes up to 12-bit and in 32-bit lanes otherwise.
+template <bool wide>
+static void vertical_sums_avx2_16(void* __restrict sums, const uint16_t* srcpp, const uint16_t* srcp, const uint16_t* srcpn, int begin, int end) noexcept
+{
+    for (int x{ begin }; x < end; x += 16)
     {
-        for (int x{ 0 }; x < width; x += 32)
+        const int count{ std::min(end - x, Vec16us::size()) };
+        const auto p{ load_simd<Vec16us>(srcpp + x, count) };
+        const auto c{ load_simd<Vec16us>(srcp + x, count) };
+        const auto n{ load_simd<Vec16us>(srcpn + x, count) };
+
+        if constexpr (!wide)
+            store_simd(p + (c << 1) + n, reinterpret_cast<uint16_t*>(sums) + x, count);
+        else
         {
-            const auto dst_lo{ extend_low(Vec32uc().load(dstp + x)) };
-            const auto temp_lo{ extend_low(Vec32uc().load(tempp + x)) };
-            const auto src_lo{ extend_low(Vec32uc().load(srcp + x)) };
-
-            const auto t_lo{ dst_lo - temp_lo };
-            const auto t2_lo{ dst_lo - v128 };
-
-            const auto nochange_mask_lo{ Vec16s(t_lo * t2_lo) < zero };
-
-            const auto t_mask_lo{ abs(t_lo) < abs(t2_lo) };
-            const auto desired_lo{ src_lo - t_lo };
-            const auto otherwise_lo{ (src_lo - dst_lo) + v128 };
-            const auto result_lo{ select(nochange_mask_lo, src_lo, select(t_mask_lo, desired_lo, otherwise_lo)) };
-            //
-            const auto dst_hi{ extend_high(Vec32uc().load(dstp + x)) };
-            const auto temp_hi{ extend_high(Vec32uc().load(tempp + x)) };
-            const auto src_hi{ extend_high(Vec32uc().load(srcp + x)) };
-
-            const auto t_hi{ dst_hi - temp_hi };
-            const auto t2_hi{ dst_hi - v128 };
-
-            const auto nochange_mask_hi{ Vec16s(t_hi * t2_hi) < zero };
-
-            const auto t_mask_hi{ abs(t_hi) < abs(t2_hi) };
-            const auto desired_hi{ src_hi - t_hi };
-            const auto otherwise_hi{ (src_hi - dst_hi) + v128 };
-            const auto result_hi{ select(nochange_mask_hi, src_hi, select(t_mask_hi, desired_hi, otherwise_hi)) };
-            // 
-            compress_saturated(result_lo, result_hi).store(dstp + x);
+            store_simd(extend_low(p) + (extend_low(c) << 1) + extend_low(n), reinterpret_cast<uint32_t*>(sums) + x, count);
+            store_simd(extend_high(p) + (extend_high(c) << 1) + extend_high(n), reinterpret_cast<uint32_t*>(sums) + x + Vec8ui::size(), std::max(count - Vec8ui::size(), 0));
         }
+    }
+}
 
-        dstp += dst_pitch;
-        srcp += src_pitch;
-        tempp += temp_pitch;
+template <bool wide>
+static Vec16us horizontal_blur_avx2_16(const void* sums_, int x, int count) noexcept
+{
+    if constexpr (!wide)
+    {
+        const uint16_t* sums{ reinterpret_cast<const uint16_t*>(sums_) + x };
+        return (load_simd<Vec16us>(sums - 1, count) + (load_simd<Vec16us>(sums, count) << 1) + load_simd<Vec16us>(sums + 1, count) + Vec16us(8)) >> 4;
+    }
+    else
+    {
+        const uint32_t* sums{ reinterpret_cast<const uint32_t*>(sums_) + x };
+        const auto result_lo{ (load_simd<Vec8ui>(sums - 1, count) + (load_simd<Vec8ui>(sums, count) << 1) + load_simd<Vec8ui>(sums + 1, count) + Vec8ui(8)) >> 4 };
+        sums += Vec8ui::size();
+        count = std::max(count - Vec8ui::size(), 0);
+        const auto result_hi{ (load_simd<Vec8ui>(sums - 1, count) + (load_simd<Vec8ui>(sums, count) << 1) + load_simd<Vec8ui>(sums + 1, count) + Vec8ui(8)) >> 4 };
+
+        return compress_saturated(result_lo, result_hi);
     }
 }
 
-template void sbr_avx2_8<0>(void* __restrict dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_8<1>(void* __restrict dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
+// The vertical blur of sbrV from the sums of vertical_sums_avx2_16(), capped like vertical_blur_avx2_16().
+template <bool wide>
+static Vec16us vertical_blur_sums_avx2_16(const void* sums_, int x, int count, const depth_avx2_16& d) noexcept
+{
+    if constexpr (!wide)
+        return min((load_simd<Vec16us>(reinterpret_cast<const uint16_t*>(sums_) + x, count) + d.rounding) >> 2, d.peak);
+    else
+    {
+        const uint32_t* sums{ reinterpret_cast<const uint32_t*>(sums_) + x };
+        const auto blur_lo{ (load_simd<Vec8ui>(sums, count) + extend_low(d.rounding)) >> 2 };
+        const auto blur_hi{ (load_simd<Vec8ui>(sums + Vec8ui::size(), std::max(count - Vec8ui::size(), 0)) + extend_high(d.rounding)) >> 2 };
+
+        return min(compress_saturated(blur_lo, blur_hi), d.peak);
+    }
+}
 
-template <int c_>
-static void vertical_blur_avx2_16(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
+// clamp(c1 - c2 + half, 0, peak) like mt_makediff and the C path, as in the 8-bit one.
+static Vec16us makediff_avx2_16(const Vec16us& c1, const Vec16us& c2, const depth_avx2_16& d) noexcept
 {
-    const uint16_t* srcp{ reinterpret_cast<const uint16_t*>(srcp_) };
-    uint16_t* __restrict dstp{ reinterpret_cast<uint16_t*>(dstp_) };
+    return min(add_saturated(sub_saturated(d.half, sub_saturated(c2, c1)), sub_saturated(c1, c2)), d.peak);
+}
 
-    const auto two{ Vec8ui(c_) };
+template <bool wide, int name>
+static void makediff_row_avx2_16(uint16_t* __restrict dstp, const uint16_t* srcpp, const uint16_t* srcp, const uint16_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums, const depth_avx2_16& d) noexcept
+{
+    if constexpr (name == 0)
+    {
+        row_simd<Vec16us>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec16us>(srcpp + x, count) };
+                const auto c{ load_simd<Vec16us>(srcp + x, count) };
+                const auto n{ load_simd<Vec16us>(srcpn + x, count) };
+
+                return makediff_avx2_16(c, vertical_blur_avx2_16<wide>(p, c, n, d), d);
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec16us, false>(dstp, srcp, x_begin, x_end, width, [&](const uint16_t* l, const uint16_t* m, const uint16_t* r, int, int count) noexcept
+            {
+                const auto c{ load_simd<Vec16us>(m, count) };
 
-    for (int y{ 0 }; y < height; ++y)
+                return makediff_avx2_16(c, vertical_blur_avx2_16<wide>(load_simd<Vec16us>(l, count), c, load_simd<Vec16us>(r, count), d), d);
+            });
+    }
+    else
     {
-        const uint16_t* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const uint16_t* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
+        vertical_sums_avx2_16<wide>(sums, srcpp, srcp, srcpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
 
-        for (int x{ 0 }; x < width; x += 16)
-        {
-            const auto p{ Vec16us().load(srcpp + x) };
-            const auto c{ Vec16us().load(srcp + x) };
-            const auto n{ Vec16us().load(srcpn + x) };
+        row_simd<Vec16us>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec16us>(srcp + x, count) };
 
-            const auto p_lo{ extend_low(p) };
-            const auto p_hi{ extend_high(p) };
-            const auto c_lo{ extend_low(c) };
-            const auto c_hi{ extend_high(c) };
-            const auto n_lo{ extend_low(n) };
-            const auto n_hi{ extend_high(n) };
+                return makediff_avx2_16(c, horizontal_blur_avx2_16<wide>(sums, x, count), d);
+            });
 
-            auto acc_lo{ c_lo + p_lo };
-            auto acc_hi{ c_hi + p_hi };
+        // The blur keeps the edge columns.
+        if (x_begin == 0)
+            dstp[0] = d.half[0];
+        if (x_end == width)
+            dstp[width - 1] = d.half[0];
+    }
+}
 
-            acc_lo = acc_lo + c_lo;
-            acc_hi = acc_hi + c_hi;
+// sbrStack: the rg11D rows of sbr (dstp) and sbrV (dstvp) from one pass of vertical sums.
+template <bool wide>
+static void makediff_stack_row_avx2_16(uint16_t* __restrict dstp, uint16_t* __restrict dstvp, const uint16_t* srcpp, const uint16_t* srcp, const uint16_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums, const depth_avx2_16& d) noexcept
+{
+    makediff_row_avx2_16<wide, 1>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, sums, d);
 
-            acc_lo = acc_lo + n_lo;
-            acc_hi = acc_hi + n_hi;
+    row_simd<Vec16us>(dstvp, x_begin, x_end, [&](int x, int count) noexcept
+        {
+            const auto c{ load_simd<Vec16us>(srcp + x, count) };
 
-            acc_lo = acc_lo + two;
-            acc_hi = acc_hi + two;
+            return makediff_avx2_16(c, vertical_blur_sums_avx2_16<wide>(sums, x, count, d), d);
+        });
+}
 
-            acc_lo = acc_lo >> 2;
-            acc_hi = acc_hi >> 2;
+// The correction is median(t, t2, 0), as in the 8-bit path.
+template <bool diff>
+static Vec16us select_avx2_16(const Vec16us& src, const Vec16us& dst, const Vec16us& temp, const depth_avx2_16& d) noexcept
+{
+    const Vec16s zero{ zero_si256() };
 
-            compress_saturated(acc_lo, acc_hi).store(dstp + x);
-        }
+    // dst - half and temp - half fit signed 16-bit lanes; a saturated t never changes the median.
+    const auto t2{ Vec16s(dst - d.half) };
+    const auto t{ sub_saturated(t2, Vec16s(temp - d.half)) };
+    const auto m{ max(min(t, t2), min(max(t, t2), zero)) };
 
-        srcp += src_pitch;
-        dstp += dst_pitch;
-    }
+    // m lies between 0 and t2 and rg11D is clamped, so the 16-bit arithmetic is exact.
+    if constexpr (diff)
+        return Vec16us(m) + d.half;
+    else
+        return src - Vec16us(m);
 }
 
-static void blur_avx2_16(void* __restrict dstp_, const void* srcp_, int dst_pitch, int src_pitch, int width, int height) noexcept
+template <bool wide, int name, bool stream, bool diff>
+static void final_row_avx2_16(uint16_t* dstp, const uint16_t* srcp, const uint16_t* diffpp, const uint16_t* diffp, const uint16_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums, const depth_avx2_16& d) noexcept
 {
-    const uint16_t* srcp{ reinterpret_cast<const uint16_t*>(srcp_) };
-    uint16_t* __restrict dstp{ reinterpret_cast<uint16_t*>(dstp_) };
+    if constexpr (name == 0)
+    {
+        output_row_simd<Vec16us, stream>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec16us>(diffpp + x, count) };
+                const auto c{ load_simd<Vec16us>(diffp + x, count) };
+                const auto n{ load_simd<Vec16us>(diffpn + x, count) };
+                const auto src{ load_simd<Vec16us>(srcp + x, count) };
+
+                return select_avx2_16<diff>(src, c, vertical_blur_avx2_16<wide>(p, c, n, d), d);
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec16us, stream>(dstp, diffp, x_begin, x_end, width, [&](const uint16_t* l, const uint16_t* m, const uint16_t* r, int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec16us>(m, count) };
+                const auto src{ load_simd<Vec16us>(srcp + x, count) };
 
-    for (int y{ 0 }; y < height; ++y)
+                return select_avx2_16<diff>(src, c, vertical_blur_avx2_16<wide>(load_simd<Vec16us>(l, count), c, load_simd<Vec16us>(r, count), d), d);
+            });
+    }
+    else
     {
-        const uint16_t* srcpp{ (y == 0) ? srcp + src_pitch : srcp - src_pitch };
-        const uint16_t* srcpn{ (y == height - 1) ? srcp - src_pitch : srcp + src_pitch };
+        vertical_sums_avx2_16<wide>(sums, diffpp, diffp, diffpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
 
-        dstp[0] = srcp[0];
+        // blur() keeps the edge columns, so t is 0 there and the source passes through.
+        const uint16_t last{ (diff) ? d.half[0] : srcp[width - 1] };
 
-        for (int x{ 1 }; x < width - 1; x += 16)
-        {
-            const auto a1{ Vec16us().load(srcpp + x - 1) };
-            const auto a2{ Vec16us().load(srcpp + x) };
-            const auto a3{ Vec16us().load(srcpp + x + 1) };
-            const auto a4{ Vec16us().load(srcp + x - 1) };
-            const auto a5{ Vec16us().load(srcp + x) };
-            const auto a6{ Vec16us().load(srcp + x + 1) };
-            const auto a7{ Vec16us().load(srcpn + x - 1) };
-            const auto a8{ Vec16us().load(srcpn + x) };
-            const auto a9{ Vec16us().load(srcpn + x + 1) };
-
-            const auto a1_lo{ extend_low(a1) };
-            const auto a2_lo{ extend_low(a2) };
-            const auto a3_lo{ extend_low(a3) };
-            const auto a4_lo{ extend_low(a4) };
-            const auto a5_lo{ extend_low(a5) };
-            const auto a6_lo{ extend_low(a6) };
-            const auto a7_lo{ extend_low(a7) };
-            const auto a8_lo{ extend_low(a8) };
-            const auto a9_lo{ extend_low(a9) };
-
-            const auto result_lo{ (a1_lo + a3_lo + a7_lo + a9_lo + ((a2_lo + a4_lo + a6_lo + a8_lo) << 1) + (a5_lo << 2) + Vec8ui(8)) >> 4 };
-            //
-            const auto a1_hi{ extend_high(a1) };
-            const auto a2_hi{ extend_high(a2) };
-            const auto a3_hi{ extend_high(a3) };
-            const auto a4_hi{ extend_high(a4) };
-            const auto a5_hi{ extend_high(a5) };
-            const auto a6_hi{ extend_high(a6) };
-            const auto a7_hi{ extend_high(a7) };
-            const auto a8_hi{ extend_high(a8) };
-            const auto a9_hi{ extend_high(a9) };
-
-            const auto result_hi{ (a1_hi + a3_hi + a7_hi + a9_hi + ((a2_hi + a4_hi + a6_hi + a8_hi) << 1) + (a5_hi << 2) + Vec8ui(8)) >> 4 };
-            //
-            compress_saturated(result_lo, result_hi).store(dstp + x);
-        }
+        if (x_begin == 0)
+            dstp[0] = (diff) ? d.half[0] : srcp[0];
 
-        dstp[width - 1] = srcp[width - 1];
+        output_row_simd<Vec16us, stream>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec16us>(diffp + x, count) };
+                const auto src{ load_simd<Vec16us>(srcp + x, count) };
 
-        srcp += src_pitch;
-        dstp += dst_pitch;
+                return select_avx2_16<diff>(src, c, horizontal_blur_avx2_16<wide>(sums, x, count), d);
+            });
+
+        if (x_end == width)
+            dstp[width - 1] = last;
     }
 }
 
-template <uint32_t u>
-static void mt_makediff_avx2_16(void* __restrict dstp_, const void* c1p_, const void* c2p_, int dst_pitch, int c1_pitch, int c2_pitch, int width, int height) noexcept
+template <bool wide, int name, bool stream>
+static void sbr_avx2_16(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip, int output, const depth_avx2_16& d) noexcept
 {
-    const uint16_t* c1p{ reinterpret_cast<const uint16_t*>(c1p_) };
-    const uint16_t* c2p{ reinterpret_cast<const uint16_t*>(c2p_) };
-    uint16_t* __restrict dstp{ reinterpret_cast<uint16_t*>(dstp_) };
+    if constexpr (name == 3)
+    {
+        sbr_fused_stack<uint16_t>([&](uint16_t* __restrict dstp, uint16_t* __restrict dstvp, const uint16_t* srcpp, const uint16_t* srcp, const uint16_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { makediff_stack_row_avx2_16<wide>(dstp, dstvp, srcpp, srcp, srcpn, x_begin, x_end, width, sums, d); },
+            [&](uint16_t* dstp, const uint16_t* srcp, const uint16_t* diffpp, const uint16_t* diffp, const uint16_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { final_row_avx2_16<wide, 1, stream, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums, d); },
+            [&](uint16_t* dstp, const uint16_t* srcp, const uint16_t* diffpp, const uint16_t* diffp, const uint16_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { final_row_avx2_16<wide, 0, stream, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums, d); },
+            dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    }
+    else
+    {
+        const auto makediff_row{ [&](uint16_t* __restrict dstp, const uint16_t* srcpp, const uint16_t* srcp, const uint16_t* srcpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { makediff_row_avx2_16<wide, name>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, sums, d); } };
+        const auto final_row{ [&](uint16_t* dstp, const uint16_t* srcp, const uint16_t* diffpp, const uint16_t* diffp, const uint16_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { final_row_avx2_16<wide, name, stream, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums, d); } };
+        const auto final_row_diff{ [&](uint16_t* dstp, const uint16_t* srcp, const uint16_t* diffpp, const uint16_t* diffp, const uint16_t* diffpn, int x_begin, int x_end, int width, void* __restrict sums) noexcept
+            { final_row_avx2_16<wide, name, stream, true>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums, d); } };
+
+        if (output == 0)
+            sbr_fused<uint16_t>(makediff_row, final_row, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+        else if (output == 1)
+            sbr_fused<uint16_t>(makediff_row, final_row_diff, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+        else
+            sbr_fused_both<uint16_t>(makediff_row, final_row, final_row_diff, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    }
+}
 
-    const auto v128{ Vec16us(u) };
+template <int name>
+void SBR_AVX2(sbr, 16)(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept
+{
+    const depth_avx2_16 d(bits);
 
-    for (int y{ 0 }; y < height; ++y)
+    if (stream)
     {
-        for (int x = 0; x < width; x += 16)
-        {
-            auto c1{ Vec16us().load(c1p + x) };
-            auto c2{ Vec16us().load(c2p + x) };
+        if (bits <= 12)
+            sbr_avx2_16<false, name, true>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output, d);
+        else
+            sbr_avx2_16<true, name, true>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output, d);
 
-            c1 = c1 - v128;
-            c2 = c2 - v128;
+        // Non-temporal stores are weakly ordered.
+        _mm_sfence();
+    }
+    else if (bits <= 12)
+        sbr_avx2_16<false, name, false>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output, d);
+    else
+        sbr_avx2_16<true, name, false>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output, d);
+}
 
-            auto diff{ c1 - c2 };
-            diff = diff + v128;
-            diff.store(dstp + x);
-        }
+template void SBR_AVX2(sbr, 16)<0>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 16)<1>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 16)<2>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 16)<3>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+// Float samples are zero-centred, so nothing is clamped; 2 * c through mul_add is exact, so the blur matches the C one.
 
-        dstp += dst_pitch;
-        c1p += c1_pitch;
-        c2p += c2_pitch;
+static Vec8f vertical_sum_avx2_32(const Vec8f& p, const Vec8f& c, const Vec8f& n) noexcept
+{
+    return mul_add(c, Vec8f(2.0f), p + n);
+}
+
+static void vertical_sums_avx2_32(float* __restrict sums, const float* srcpp, const float* srcp, const float* srcpn, int begin, int end) noexcept
+{
+    for (int x{ begin }; x < end; x += 8)
+    {
+        const int count{ std::min(end - x, Vec8f::size()) };
+        const auto p{ load_simd<Vec8f>(srcpp + x, count) };
+        const auto c{ load_simd<Vec8f>(srcp + x, count) };
+        const auto n{ load_simd<Vec8f>(srcpn + x, count) };
+
+        store_simd(vertical_sum_avx2_32(p, c, n), sums + x, count);
     }
 }
 
-template <int c, int h, uint32_t u, int name>
-void sbr_avx2_16(void* __restrict dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept
+static Vec8f horizontal_blur_avx2_32(const float* sums, int count) noexcept
+{
+    return mul_add(load_simd<Vec8f>(sums, count), Vec8f(2.0f), load_simd<Vec8f>(sums - 1, count) + load_simd<Vec8f>(sums + 1, count)) * Vec8f(0.0625f);
+}
+
+template <int name>
+static void makediff_row_avx2_32(float* __restrict dstp, const float* srcpp, const float* srcp, const float* srcpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
 {
     if constexpr (name == 0)
     {
-        vertical_blur_avx2_16<c>(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_avx2_16<u>(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        vertical_blur_avx2_16<c>(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.vblur()
+        row_simd<Vec8f>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec8f>(srcpp + x, count) };
+                const auto c{ load_simd<Vec8f>(srcp + x, count) };
+                const auto n{ load_simd<Vec8f>(srcpn + x, count) };
+
+                return c - vertical_sum_avx2_32(p, c, n) * Vec8f(0.25f);
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec8f, false>(dstp, srcp, x_begin, x_end, width, [&](const float* l, const float* m, const float* r, int, int count) noexcept
+            {
+                const auto c{ load_simd<Vec8f>(m, count) };
+
+                return c - vertical_sum_avx2_32(load_simd<Vec8f>(l, count), c, load_simd<Vec8f>(r, count)) * Vec8f(0.25f);
+            });
     }
     else
     {
-        blur_avx2_16(tempp_, srcp_, temp_pitch, src_pitch, width, height); //temp = rg11
-        mt_makediff_avx2_16<u>(dstp_, srcp_, tempp_, dst_pitch, src_pitch, temp_pitch, width, height); //dst = rg11D
-        blur_avx2_16(tempp_, dstp_, temp_pitch, dst_pitch, width, height); //temp = rg11D.blur()
+        float* sums{ reinterpret_cast<float*>(sums_) };
+        vertical_sums_avx2_32(sums, srcpp, srcp, srcpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
+
+        row_simd<Vec8f>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec8f>(srcp + x, count) };
+
+                return c - horizontal_blur_avx2_32(sums + x, count);
+            });
+
+        // The blur keeps the edge columns.
+        if (x_begin == 0)
+            dstp[0] = 0.0f;
+        if (x_end == width)
+            dstp[width - 1] = 0.0f;
     }
+}
 
-    const uint16_t* srcp{ reinterpret_cast<const uint16_t*>(srcp_) };
-    uint16_t* __restrict tempp{ reinterpret_cast<uint16_t*>(tempp_) };
-    uint16_t* __restrict dstp{ reinterpret_cast<uint16_t*>(dstp_) };
+// sbrStack: the rg11D rows of sbr (dstp) and sbrV (dstvp) from one pass of vertical sums.
+static void makediff_stack_row_avx2_32(float* __restrict dstp, float* __restrict dstvp, const float* srcpp, const float* srcp, const float* srcpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
+{
+    makediff_row_avx2_32<1>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, sums_);
 
-    const Vec8ui zero{ zero_si256() };
-    const auto v128{ Vec8ui(h) };
+    const float* sums{ reinterpret_cast<const float*>(sums_) };
 
-    for (int y{ 0 }; y < height; ++y)
-    {
-        for (int x{ 0 }; x < width; x += 16)
+    row_simd<Vec8f>(dstvp, x_begin, x_end, [&](int x, int count) noexcept
         {
-            const auto dst_lo{ extend_low(Vec16us().load(dstp + x)) };
-            const auto temp_lo{ extend_low(Vec16us().load(tempp + x)) };
-            const auto src_lo{ extend_low(Vec16us().load(srcp + x)) };
-
-            const auto t_lo{ dst_lo - temp_lo };
-            const auto t2_lo{ dst_lo - v128 };
-
-            const auto nochange_mask_lo{ Vec8i(t_lo * t2_lo) < zero };
-
-            const auto t_mask_lo{ abs(t_lo) < abs(t2_lo) };
-            const auto desired_lo{ src_lo - t_lo };
-            const auto otherwise_lo{ (src_lo - dst_lo) + v128 };
-            const auto result_lo{ select(nochange_mask_lo, src_lo, select(t_mask_lo, desired_lo, otherwise_lo)) };
-            //
-            const auto dst_hi{ extend_high(Vec16us().load(dstp + x)) };
-            const auto temp_hi{ extend_high(Vec16us().load(tempp + x)) };
-            const auto src_hi{ extend_high(Vec16us().load(srcp + x)) };
-
-            const auto t_hi{ dst_hi - temp_hi };
-            const auto t2_hi{ dst_hi - v128 };
-
-            const auto nochange_mask_hi{ Vec8i(t_hi * t2_hi) < zero };
-
-            const auto t_mask_hi{ abs(t_hi) < abs(t2_hi) };
-            const auto desired_hi{ src_hi - t_hi };
-            const auto otherwise_hi{ (src_hi - dst_hi) + v128 };
-            const auto result_hi{ select(nochange_mask_hi, src_hi, select(t_mask_hi, desired_hi, otherwise_hi)) };
-            // 
-            compress_saturated(result_lo, result_hi).store(dstp + x);
-        }
+            return load_simd<Vec8f>(srcp + x, count) - load_simd<Vec8f>(sums + x, count) * Vec8f(0.25f);
+        });
+}
 
-        dstp += dst_pitch;
-        srcp += src_pitch;
-        tempp += temp_pitch;
+// median(t, t2, 0) with t2 = dst, as in the integer paths. The difference of diff is zero-centred like the samples.
+template <bool diff>
+static Vec8f select_avx2_32(const Vec8f& src, const Vec8f& dst, const Vec8f& temp) noexcept
+{
+    const Vec8f zero{ 0.0f };
+
+    const auto t{ dst - temp };
+    const auto m{ max(min(t, dst), min(max(t, dst), zero)) };
+
+    if constexpr (diff)
+        return m;
+    else
+        return src - m;
+}
+
+template <int name, bool stream, bool diff>
+static void final_row_avx2_32(float* dstp, const float* srcp, const float* diffpp, const float* diffp, const float* diffpn, int x_begin, int x_end, int width, void* __restrict sums_) noexcept
+{
+    if constexpr (name == 0)
+    {
+        output_row_simd<Vec8f, stream>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec8f>(diffpp + x, count) };
+                const auto c{ load_simd<Vec8f>(diffp + x, count) };
+                const auto n{ load_simd<Vec8f>(diffpn + x, count) };
+                const auto src{ load_simd<Vec8f>(srcp + x, count) };
+
+                return select_avx2_32<diff>(src, c, vertical_sum_avx2_32(p, c, n) * Vec8f(0.25f));
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec8f, stream>(dstp, diffp, x_begin, x_end, width, [&](const float* l, const float* m, const float* r, int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec8f>(m, count) };
+                const auto src{ load_simd<Vec8f>(srcp + x, count) };
+
+                return select_avx2_32<diff>(src, c, vertical_sum_avx2_32(load_simd<Vec8f>(l, count), c, load_simd<Vec8f>(r, count)) * Vec8f(0.25f));
+            });
+    }
+    else
+    {
+        float* sums{ reinterpret_cast<float*>(sums_) };
+        vertical_sums_avx2_32(sums, diffpp, diffp, diffpn, std::max(x_begin - 1, 0), std::min(x_end + 1, width));
+
+        // blur() keeps the edge columns, so t is 0 there and the source passes through.
+        const float last{ (diff) ? 0.0f : srcp[width - 1] };
+
+        if (x_begin == 0)
+            dstp[0] = (diff) ? 0.0f : srcp[0];
+
+        output_row_simd<Vec8f, stream>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec8f>(diffp + x, count) };
+                const auto src{ load_simd<Vec8f>(srcp + x, count) };
+
+                return select_avx2_32<diff>(src, c, horizontal_blur_avx2_32(sums + x, count));
+            });
+
+        if (x_end == width)
+            dstp[width - 1] = last;
     }
 }
 
-template void sbr_avx2_16<3, 512, 0x200200, 0>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<4, 2048, 0x800800, 0>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<16, 8192, 0x20002000, 0>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<64, 32768, 0x80008000, 0>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
+template <int name, bool stream>
+static void sbr_avx2_32(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip, int output) noexcept
+{
+    if constexpr (name == 3)
+        sbr_fused_stack<float>(makediff_stack_row_avx2_32, final_row_avx2_32<1, stream, false>, final_row_avx2_32<0, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 0)
+        sbr_fused<float>(makediff_row_avx2_32<name>, final_row_avx2_32<name, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 1)
+        sbr_fused<float>(makediff_row_avx2_32<name>, final_row_avx2_32<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else
+        sbr_fused_both<float>(makediff_row_avx2_32<name>, final_row_avx2_32<name, stream, false>, final_row_avx2_32<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+}
+
+template <int name>
+void SBR_AVX2(sbr, 32)(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int, int strip, bool stream, int output) noexcept
+{
+    if (stream)
+    {
+        sbr_avx2_32<name, true>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+        // Non-temporal stores are weakly ordered.
+        _mm_sfence();
+    }
+    else
+        sbr_avx2_32<name, false>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+}
 
-template void sbr_avx2_16<3, 512, 0x200200, 1>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<4, 2048, 0x800800, 1>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<16, 8192, 0x20002000, 1>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
-template void sbr_avx2_16<64, 32768, 0x80008000, 1>(void* __restrict dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height) noexcept;
+template void SBR_AVX2(sbr, 32)<0>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 32)<1>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 32)<2>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void SBR_AVX2(sbr, 32)<3>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
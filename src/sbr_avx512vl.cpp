@@ -0,0 +1,6 @@
+// The AVX2 kernels built with AVX512VL: masked tails and mask registers, but no zmm (see the avx512vl_ymm_only test).
+// VCL gets a namespace of its own, since its classes differ from those of the AVX2 file.
+#define SBR_AVX2(name, depth) name##_avx512vl_##depth
+#define VCL_NAMESPACE vcl_avx512vl
+
+#include "sbr_avx2.cpp"
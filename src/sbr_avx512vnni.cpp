@@ -0,0 +1,184 @@
+#include "sbr_kernels.h"
+#include "sbr_simd.h"
+
+// (p + 2 * c + n + 2) >> 2 in byte lanes: pavgb(c, (p + n) >> 1), with (p + n) >> 1 from pavgb(p, n).
+static Vec64uc vertical_blur_avx512vnni_8(const Vec64uc& p, const Vec64uc& c, const Vec64uc& n) noexcept
+{
+    const Vec64uc pn{ _mm512_avg_epu8(p, n) };
+    return _mm512_avg_epu8(c, pn - ((p ^ n) & Vec64uc(1)));
+}
+
+// The 3x3 blur of 64 bytes from x on, one vpdpbusd per row and phase: phase k sums bytes x + 4 * j + k - 1..+1.
+// avail is the number of bytes of the rows from x - 1 on.
+static Vec64uc blur_avx512vnni_8(const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int x, int avail) noexcept
+{
+    const auto phase{ [&](int k) noexcept
+        {
+            const int count{ std::max(avail - k, 0) };
+            const auto p{ load_simd<Vec64uc>(srcpp + x + k - 1, count) };
+            const auto c{ load_simd<Vec64uc>(srcp + x + k - 1, count) };
+            const auto n{ load_simd<Vec64uc>(srcpn + x + k - 1, count) };
+
+            // 16 * (sum + 8) is at most 65408, so it stays in the low word.
+            __m512i acc{ _mm512_dpbusd_epi32(_mm512_set1_epi32(128), p, _mm512_set1_epi32(0x00102010)) };
+            acc = _mm512_dpbusd_epi32(acc, c, _mm512_set1_epi32(0x00204020));
+            return _mm512_dpbusd_epi32(acc, n, _mm512_set1_epi32(0x00102010));
+        } };
+
+    // Byte 4 * j + k of the result is byte 1 of dword j of phase k.
+    const __m512i gather{ _mm512_setr_epi32(0x41014101, 0x45054505, 0x49094909, 0x4D0D4D0D, 0x51115111, 0x55155515, 0x59195919, 0x5D1D5D1D,
+        0x61216121, 0x65256525, 0x69296929, 0x6D2D6D2D, 0x71317131, 0x75357535, 0x79397939, 0x7D3D7D3D) };
+
+    const __m512i phases01{ _mm512_permutex2var_epi8(phase(0), gather, phase(1)) };
+    const __m512i phases23{ _mm512_permutex2var_epi8(phase(2), gather, phase(3)) };
+
+    return _mm512_mask_blend_epi8(0xCCCCCCCCCCCCCCCC, phases01, phases23);
+}
+
+// clamp(c1 - c2 + 128, 0, 255) like mt_makediff, from two saturated differences.
+static Vec64uc makediff_avx512vnni_8(const Vec64uc& c1, const Vec64uc& c2) noexcept
+{
+    return add_saturated(sub_saturated(Vec64uc(128), sub_saturated(c2, c1)), sub_saturated(c1, c2));
+}
+
+template <int name>
+static void makediff_row_avx512vnni_8(uint8_t* __restrict dstp, const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int x_begin, int x_end, int width, void*) noexcept
+{
+    if constexpr (name == 0)
+    {
+        row_simd<Vec64uc>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec64uc>(srcpp + x, count) };
+                const auto c{ load_simd<Vec64uc>(srcp + x, count) };
+                const auto n{ load_simd<Vec64uc>(srcpn + x, count) };
+
+                return makediff_avx512vnni_8(c, vertical_blur_avx512vnni_8(p, c, n));
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec64uc, false>(dstp, srcp, x_begin, x_end, width, [&](const uint8_t* l, const uint8_t* m, const uint8_t* r, int, int count) noexcept
+            {
+                const auto c{ load_simd<Vec64uc>(m, count) };
+
+                return makediff_avx512vnni_8(c, vertical_blur_avx512vnni_8(load_simd<Vec64uc>(l, count), c, load_simd<Vec64uc>(r, count)));
+            });
+    }
+    else
+    {
+        row_simd<Vec64uc>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec64uc>(srcp + x, count) };
+
+                return makediff_avx512vnni_8(c, blur_avx512vnni_8(srcpp, srcp, srcpn, x, width - x + 1));
+            });
+
+        // The blur keeps the edge columns.
+        if (x_begin == 0)
+            dstp[0] = 128;
+        if (x_end == width)
+            dstp[width - 1] = 128;
+    }
+}
+
+// The correction is median(t, t2, 0) with t = dst - temp and t2 = dst - 128. diff returns the correction + 128.
+template <bool diff>
+static Vec64uc select_avx512vnni_8(const Vec64uc& src, const Vec64uc& dst, const Vec64uc& temp) noexcept
+{
+    const Vec64c zero{ zero_si512() };
+    const auto v128{ Vec64uc(128) };
+
+    const auto t2{ Vec64c(dst ^ v128) };
+    const auto t{ sub_saturated(t2, Vec64c(temp ^ v128)) };
+    const auto m{ max(min(t, t2), min(max(t, t2), zero)) };
+
+    // m lies between 0 and t2 and rg11D is clamped, so the byte arithmetic is exact.
+    if constexpr (diff)
+        return Vec64uc(m) ^ v128;
+    else
+        return src - Vec64uc(m);
+}
+
+template <int name, bool stream, bool diff>
+static void final_row_avx512vnni_8(uint8_t* dstp, const uint8_t* srcp, const uint8_t* diffpp, const uint8_t* diffp, const uint8_t* diffpn, int x_begin, int x_end, int width, void*) noexcept
+{
+    if constexpr (name == 0)
+    {
+        output_row_simd<Vec64uc, stream>(dstp, x_begin, x_end, [&](int x, int count) noexcept
+            {
+                const auto p{ load_simd<Vec64uc>(diffpp + x, count) };
+                const auto c{ load_simd<Vec64uc>(diffp + x, count) };
+                const auto n{ load_simd<Vec64uc>(diffpn + x, count) };
+                const auto src{ load_simd<Vec64uc>(srcp + x, count) };
+
+                return select_avx512vnni_8<diff>(src, c, vertical_blur_avx512vnni_8(p, c, n));
+            });
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_simd<Vec64uc, stream>(dstp, diffp, x_begin, x_end, width, [&](const uint8_t* l, const uint8_t* m, const uint8_t* r, int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec64uc>(m, count) };
+                const auto src{ load_simd<Vec64uc>(srcp + x, count) };
+
+                return select_avx512vnni_8<diff>(src, c, vertical_blur_avx512vnni_8(load_simd<Vec64uc>(l, count), c, load_simd<Vec64uc>(r, count)));
+            });
+    }
+    else
+    {
+        // blur() keeps the edge columns, so t is 0 there and the source passes through.
+        const uint8_t last{ (diff) ? static_cast<uint8_t>(128) : srcp[width - 1] };
+
+        if (x_begin == 0)
+            dstp[0] = (diff) ? 128 : srcp[0];
+
+        output_row_simd<Vec64uc, stream>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept
+            {
+                const auto c{ load_simd<Vec64uc>(diffp + x, count) };
+                const auto src{ load_simd<Vec64uc>(srcp + x, count) };
+
+                return select_avx512vnni_8<diff>(src, c, blur_avx512vnni_8(diffpp, diffp, diffpn, x, width - x + 1));
+            });
+
+        if (x_end == width)
+            dstp[width - 1] = last;
+    }
+}
+
+// sbrStack: without vertical sums to share, both rg11D rows are computed on their own from the same source rows.
+static void makediff_stack_row_avx512vnni_8(uint8_t* __restrict dstp, uint8_t* __restrict dstvp, const uint8_t* srcpp, const uint8_t* srcp, const uint8_t* srcpn, int x_begin, int x_end, int width, void* sums) noexcept
+{
+    makediff_row_avx512vnni_8<1>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, sums);
+    makediff_row_avx512vnni_8<0>(dstvp, srcpp, srcp, srcpn, x_begin, x_end, width, sums);
+}
+
+template <int name, bool stream>
+static void sbr_avx512vnni_8(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip, int output) noexcept
+{
+    if constexpr (name == 3)
+        sbr_fused_stack<uint8_t>(makediff_stack_row_avx512vnni_8, final_row_avx512vnni_8<1, stream, false>, final_row_avx512vnni_8<0, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 0)
+        sbr_fused<uint8_t>(makediff_row_avx512vnni_8<name>, final_row_avx512vnni_8<name, stream, false>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else if (output == 1)
+        sbr_fused<uint8_t>(makediff_row_avx512vnni_8<name>, final_row_avx512vnni_8<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else
+        sbr_fused_both<uint8_t>(makediff_row_avx512vnni_8<name>, final_row_avx512vnni_8<name, stream, false>, final_row_avx512vnni_8<name, stream, true>, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+}
+
+template <int name>
+void sbr_avx512vnni_8(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int, int strip, bool stream, int output) noexcept
+{
+    if (stream)
+    {
+        sbr_avx512vnni_8<name, true>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+        // Non-temporal stores are weakly ordered.
+        _mm_sfence();
+    }
+    else
+        sbr_avx512vnni_8<name, false>(dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip, output);
+}
+
+template void sbr_avx512vnni_8<0>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_avx512vnni_8<1>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_avx512vnni_8<2>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_avx512vnni_8<3>(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
@@ -0,0 +1,299 @@
+#include <type_traits>
+
+#include "sbr_kernels.h"
+#include "VCL2/instrset.h"
+
+// Float samples are zero-centred, so h is 0 and nothing is clamped. The blur is (p + n) + 2 * c like in SIMD.
+template <typename T>
+static T vertical_blur_float(const T* srcpp, const T* srcp, const T* srcpn, int x) noexcept
+{
+    return srcpp[x] + srcpn[x] + srcp[x] * 2.0f;
+}
+
+template <typename T>
+static T blur_float(const T* srcpp, const T* srcp, const T* srcpn, int x) noexcept
+{
+    return (vertical_blur_float(srcpp, srcp, srcpn, x - 1) + vertical_blur_float(srcpp, srcp, srcpn, x + 1) + vertical_blur_float(srcpp, srcp, srcpn, x) * 2.0f) * 0.0625f;
+}
+
+// Calls f(x, left, right) for the columns [x_begin, x_end) of a row of sbrH, the mirrored edges outside the loop.
+template <typename F>
+static void horizontal_row_c(int x_begin, int x_end, int width, F f) noexcept
+{
+    if (x_begin == 0)
+        f(0, std::min(width - 1, 1), std::min(width - 1, 1));
+
+    for (int x{ std::max(x_begin, 1) }; x < std::min(x_end, width - 1); ++x)
+        f(x, x - 1, x + 1);
+
+    if (x_end == width && width > 1)
+        f(width - 1, width - 2, width - 2);
+}
+
+// c, p and h are the vertical rounding, the peak and the half of the bit depth (all 0 for float).
+template <typename T, int name>
+static void makediff_row_c(T* __restrict dstp, const T* srcpp, const T* srcp, const T* srcpn, int x_begin, int x_end, int width, int c, int p, int h) noexcept
+{
+    if constexpr (name == 0)
+    {
+        for (int x{ x_begin }; x < x_end; ++x)
+        {
+            if constexpr (std::is_integral_v<T>)
+            {
+                // The rounding can push the blur past the peak, e.g. (4 * 65535 + 64) >> 2, so it is capped.
+                const T blur{ static_cast<T>(std::min((srcpp[x] + (srcp[x] << 1) + srcpn[x] + c) >> 2, p)) };
+                dstp[x] = std::max(std::min(srcp[x] - blur + h, p), 0);
+            }
+            else
+                dstp[x] = srcp[x] - vertical_blur_float(srcpp, srcp, srcpn, x) * 0.25f;
+        }
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_c(x_begin, x_end, width, [&](int x, int l, int r) noexcept
+            {
+                if constexpr (std::is_integral_v<T>)
+                {
+                    const T blur{ static_cast<T>(std::min((srcp[l] + (srcp[x] << 1) + srcp[r] + c) >> 2, p)) };
+                    dstp[x] = std::max(std::min(srcp[x] - blur + h, p), 0);
+                }
+                else
+                    dstp[x] = srcp[x] - (srcp[l] + srcp[r] + srcp[x] * 2.0f) * 0.25f;
+            });
+    }
+    else
+    {
+        // The blur keeps the edge columns.
+        if (x_begin == 0)
+            dstp[0] = h;
+
+        for (int x{ std::max(x_begin, 1) }; x < std::min(x_end, width - 1); ++x)
+        {
+            if constexpr (std::is_integral_v<T>)
+            {
+                const T blur{ static_cast<T>((srcpp[x - 1] + srcpp[x + 1] + srcpn[x - 1] + srcpn[x + 1] + ((srcpp[x] + srcp[x - 1] + srcp[x + 1] + srcpn[x]) << 1) + (srcp[x] << 2) + 8) >> 4) };
+                dstp[x] = std::max(std::min(srcp[x] - blur + h, p), 0);
+            }
+            else
+                dstp[x] = srcp[x] - blur_float(srcpp, srcp, srcpn, x);
+        }
+
+        if (x_end == width)
+            dstp[width - 1] = h;
+    }
+}
+
+// The correction is median(t, t2, 0), t2 on a tie. diff returns the correction + h, i.e. mt_makediff(src, output).
+template <typename T, typename U, bool diff>
+static T select_c(U src, U dst, U temp, int h) noexcept
+{
+    const U t{ dst - temp };
+    const U t2{ dst - static_cast<U>(h) };
+    const U m{ std::max(std::min(t, t2), std::min(std::max(t, t2), U(0))) };
+
+    if constexpr (diff)
+        return m + static_cast<U>(h);
+    else
+        return src - m;
+}
+
+template <typename T, int name, bool diff>
+static void final_row_c(T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, int c, int p, int h) noexcept
+{
+    // Integer samples are selected in int.
+    using U = std::conditional_t<std::is_integral_v<T>, int, T>;
+
+    if constexpr (name == 0)
+    {
+        for (int x{ x_begin }; x < x_end; ++x)
+        {
+            T temp;
+
+            if constexpr (std::is_integral_v<T>)
+                temp = static_cast<T>(std::min((diffpp[x] + (diffp[x] << 1) + diffpn[x] + c) >> 2, p));
+            else
+                temp = vertical_blur_float(diffpp, diffp, diffpn, x) * 0.25f;
+
+            dstp[x] = select_c<T, U, diff>(srcp[x], diffp[x], temp, h);
+        }
+    }
+    else if constexpr (name == 2)
+    {
+        horizontal_row_c(x_begin, x_end, width, [&](int x, int l, int r) noexcept
+            {
+                T temp;
+
+                if constexpr (std::is_integral_v<T>)
+                    temp = static_cast<T>(std::min((diffp[l] + (diffp[x] << 1) + diffp[r] + c) >> 2, p));
+                else
+                    temp = (diffp[l] + diffp[r] + diffp[x] * 2.0f) * 0.25f;
+
+                dstp[x] = select_c<T, U, diff>(srcp[x], diffp[x], temp, h);
+            });
+    }
+    else
+    {
+        // blur() keeps the edge columns, so t is 0 there and the source passes through.
+        if (x_begin == 0)
+            dstp[0] = (diff) ? static_cast<T>(h) : srcp[0];
+
+        for (int x{ std::max(x_begin, 1) }; x < std::min(x_end, width - 1); ++x)
+        {
+            T temp;
+
+            if constexpr (std::is_integral_v<T>)
+                temp = static_cast<T>((diffpp[x - 1] + diffpp[x + 1] + diffpn[x - 1] + diffpn[x + 1] + ((diffpp[x] + diffp[x - 1] + diffp[x + 1] + diffpn[x]) << 1) + (diffp[x] << 2) + 8) >> 4);
+            else
+                temp = blur_float(diffpp, diffp, diffpn, x);
+
+            dstp[x] = select_c<T, U, diff>(srcp[x], diffp[x], temp, h);
+        }
+
+        if (x_end == width)
+            dstp[width - 1] = (diff) ? static_cast<T>(h) : srcp[width - 1];
+    }
+}
+
+template <typename T, int name>
+void sbr_c(void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool, int output) noexcept
+{
+    int c{ 0 };
+    int p{ 0 };
+    int h{ 0 };
+
+    if constexpr (std::is_integral_v<T>)
+    {
+        c = vertical_rounding(bits);
+        p = (1 << bits) - 1;
+        h = 1 << (bits - 1);
+    }
+
+    if constexpr (name == 3)
+        // The reference for the SIMD kernels: both rg11D rows are computed on their own.
+        sbr_fused_stack<T>([=](T* __restrict dstp, T* __restrict dstvp, const T* srcpp, const T* srcp, const T* srcpn, int x_begin, int x_end, int width, void*) noexcept
+            {
+                makediff_row_c<T, 1>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, c, p, h);
+                makediff_row_c<T, 0>(dstvp, srcpp, srcp, srcpn, x_begin, x_end, width, c, p, h);
+            },
+            [=](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void*) noexcept
+            { final_row_c<T, 1, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, c, p, h); },
+            [=](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void*) noexcept
+            { final_row_c<T, 0, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, c, p, h); },
+            dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    else
+    {
+        const auto makediff_row{ [=](T* __restrict dstp, const T* srcpp, const T* srcp, const T* srcpn, int x_begin, int x_end, int width, void*) noexcept
+            { makediff_row_c<T, name>(dstp, srcpp, srcp, srcpn, x_begin, x_end, width, c, p, h); } };
+        const auto final_row{ [=](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void*) noexcept
+            { final_row_c<T, name, false>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, c, p, h); } };
+        const auto final_row_diff{ [=](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void*) noexcept
+            { final_row_c<T, name, true>(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, c, p, h); } };
+
+        if (output == 0)
+            sbr_fused<T>(makediff_row, final_row, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+        else if (output == 1)
+            sbr_fused<T>(makediff_row, final_row_diff, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+        else
+            sbr_fused_both<T>(makediff_row, final_row, final_row_diff, dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+    }
+}
+
+template void sbr_c<uint8_t, 0>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint8_t, 1>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint8_t, 2>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint8_t, 3>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template void sbr_c<uint16_t, 0>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint16_t, 1>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint16_t, 2>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<uint16_t, 3>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template void sbr_c<float, 0>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<float, 1>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<float, 2>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template void sbr_c<float, 3>(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+int cache_size(int level) noexcept
+{
+    int abcd[4];
+
+    const auto deterministic{ [&](int leaf) noexcept
+        {
+            for (int i{ 0 }; i < 8; ++i)
+            {
+                cpuid(abcd, leaf, i);
+
+                const int type{ abcd[0] & 0x1F };
+
+                if (type == 0)
+                    break;
+                // Data or unified cache of the level.
+                if ((type == 1 || type == 3) && ((abcd[0] >> 5) & 7) == level)
+                    return (((abcd[1] >> 22) & 0x3FF) + 1) * (((abcd[1] >> 12) & 0x3FF) + 1) * ((abcd[1] & 0xFFF) + 1) * (abcd[2] + 1);
+            }
+
+            return 0;
+        } };
+
+    cpuid(abcd, 0);
+    int size{ (abcd[0] >= 4) ? deterministic(4) : 0 };
+
+    cpuid(abcd, 0x80000000);
+    const unsigned max_extended{ static_cast<unsigned>(abcd[0]) };
+
+    if (size == 0 && max_extended >= 0x8000001D)
+        size = deterministic(static_cast<int>(0x8000001D));
+    if (size == 0 && max_extended >= 0x80000006 && level >= 2)
+    {
+        cpuid(abcd, 0x80000006);
+        size = (level == 2) ? ((abcd[2] >> 16) & 0xFFFF) * 1024 : ((abcd[3] >> 18) & 0x3FFF) * 512 * 1024;
+    }
+
+    return size;
+}
+
+int cache_strip(int sample_size) noexcept
+{
+    static const int l2{ cache_size(2) };
+
+    // About 16 rows of a strip are in use at once; they get half of the L2 cache (1 MiB when unknown).
+    return std::max((((l2 > 0) ? l2 : 1024 * 1024) / (32 * sample_size)) & ~63, 1024);
+}
+
+int cache_band(int row_size) noexcept
+{
+    static const int l2{ cache_size(2) };
+
+    // Each buffer gets a quarter of the L2 cache (1 MiB when unknown), and at least 64 rows to keep the halo small.
+    return std::max(((l2 > 0) ? l2 : 1024 * 1024) / (4 * row_size), 64);
+}
+
+int cache_llc() noexcept
+{
+    static const int llc{ std::max(cache_size(3), cache_size(2)) };
+
+    return (llc > 0) ? llc : 8 * 1024 * 1024;
+}
+
+// The AVX2 and AVX512 files are built with FMA; the AVX512 kernels use BW, DQ and VL, the VNNI tier also VNNI and VBMI.
+bool isa_supported(int isa) noexcept
+{
+    const int level{ instrset_detect() };
+
+    switch (isa)
+    {
+        case 5:
+        case 3: return level >= 10 && hasFMA3();
+        case 4:
+        {
+            int abcd[4];
+            cpuid(abcd, 7);
+
+            // ecx bit 1: AVX512 VBMI, bit 11: AVX512 VNNI.
+            return level >= 10 && hasFMA3() && (abcd[2] & 0x802) == 0x802;
+        }
+        case 2: return level >= 8 && hasFMA3();
+        case 1: return level >= 2;
+        default: return true;
+    }
+}
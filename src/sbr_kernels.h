@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// The row kernels. Nothing here depends on AviSynth, so the kernels can also be driven directly (see bench/).
+
+// One pass over rows [y_begin, y_end): rg11D lives in a three-row ring (tempp) followed by two rows of sums.
+// Planes wider than strip columns run in strips (see cache_strip()), which need dstp != srcp.
+// makediff_row(rg11D_row, src_above, src_row, src_below, x_begin, x_end, width, sums)
+// final_row(dst_row, src_row, rg11D_above, rg11D_row, rg11D_below, x_begin, x_end, width, sums)
+// Static so that every kernel file keeps the instantiation of its own instruction set.
+template <typename T, typename MakediffRow, typename FinalRow>
+static void sbr_fused(MakediffRow makediff_row, FinalRow final_row, void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip) noexcept
+{
+    const T* srcp{ reinterpret_cast<const T*>(srcp_) };
+    T* __restrict tempp{ reinterpret_cast<T*>(tempp_) };
+    void* sums{ tempp + 3 * temp_pitch };
+
+    // Edge rows are mirrored: row -1 is row 1 and row height is row height - 2.
+    const auto mirror{ [height](int y) noexcept { return (y < 0) ? std::min(-y, height - 1) : ((y >= height) ? std::max(2 * height - 2 - y, 0) : y); } };
+    const auto src_row{ [&](int y) noexcept { return srcp + mirror(y) * src_pitch; } };
+    const auto ring_row{ [&](int y) noexcept { return tempp + (mirror(y) % 3) * temp_pitch; } };
+
+    // Equal strips on 64-byte boundaries, so that no strip is much narrower than the others.
+    const int strips{ (strip > 0 && strip < width) ? (width + strip - 1) / strip : 1 };
+    const int step{ (strips > 1) ? ((width + strips - 1) / strips + 64 / static_cast<int>(sizeof(T)) - 1) & ~(64 / static_cast<int>(sizeof(T)) - 1) : width };
+
+    for (int x_begin{ 0 }; x_begin < width; x_begin += step)
+    {
+        const int x_end{ std::min(x_begin + step, width) };
+        const int diff_begin{ std::max(x_begin - 1, 0) };
+        const int diff_end{ std::min(x_end + 1, width) };
+        T* dstp{ reinterpret_cast<T*>(dstp_) + y_begin * dst_pitch };
+
+        for (int y{ std::max(y_begin - 1, 0) }; y <= y_begin; ++y)
+            makediff_row(ring_row(y), src_row(y - 1), src_row(y), src_row(y + 1), diff_begin, diff_end, width, sums);
+
+        for (int y{ y_begin }; y < y_end; ++y)
+        {
+            if (y < height - 1)
+                makediff_row(ring_row(y + 1), src_row(y), src_row(y + 1), src_row(y + 2), diff_begin, diff_end, width, sums);
+
+            final_row(dstp, src_row(y), ring_row(y - 1), ring_row(y), ring_row(y + 1), x_begin, x_end, width, sums);
+
+            dstp += dst_pitch;
+        }
+    }
+}
+
+// sbr_fused() for sbrStack: sbr into rows [0, height), sbrV below it from a second ring.
+// makediff_row(rg11D_row, rg11D_v_row, src_above, src_row, src_below, x_begin, x_end, width, sums)
+template <typename T, typename MakediffRow, typename FinalRow, typename FinalRowV>
+static void sbr_fused_stack(MakediffRow makediff_row, FinalRow final_row, FinalRowV final_row_v, void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip) noexcept
+{
+    const int v_ring{ 5 * temp_pitch };
+    const int v_rows{ height * dst_pitch };
+
+    sbr_fused<T>([&](T* __restrict dstp, const T* srcpp, const T* srcp, const T* srcpn, int x_begin, int x_end, int width, void* sums) noexcept
+        { makediff_row(dstp, dstp + v_ring, srcpp, srcp, srcpn, x_begin, x_end, width, sums); },
+        [&](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void* sums) noexcept
+        {
+            final_row(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums);
+            final_row_v(dstp + v_rows, srcp, diffpp + v_ring, diffp + v_ring, diffpn + v_ring, x_begin, x_end, width, sums);
+        },
+        dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+}
+
+// sbr_fused() with final_row into rows [0, height) and final_row_2 below it, from the same rg11D rows.
+template <typename T, typename MakediffRow, typename FinalRow, typename FinalRow2>
+static void sbr_fused_both(MakediffRow makediff_row, FinalRow final_row, FinalRow2 final_row_2, void* dstp_, void* __restrict tempp_, const void* srcp_, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int strip) noexcept
+{
+    const int rows{ height * dst_pitch };
+
+    sbr_fused<T>(makediff_row, [&](T* dstp, const T* srcp, const T* diffpp, const T* diffp, const T* diffpn, int x_begin, int x_end, int width, void* sums) noexcept
+        {
+            final_row(dstp, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums);
+            final_row_2(dstp + rows, srcp, diffpp, diffp, diffpn, x_begin, x_end, width, sums);
+        },
+        dstp_, tempp_, srcp_, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, strip);
+}
+
+// Rows of temp_pitch that tempp holds for a kernel: the rg11D ring and the sums, and the ring of sbrV for sbrStack.
+constexpr int scratch_rows(int name) noexcept
+{
+    return (name == 3) ? 8 : 5;
+}
+
+// Size in bytes of the data cache of a level (1..3) from CPUID, 0 when the CPU does not report it.
+int cache_size(int level) noexcept;
+
+// Strip width in columns for sbr_fused() from the L2 cache size.
+int cache_strip(int sample_size) noexcept;
+
+// Rows per band of sbr_passes() for rows of row_size bytes from the L2 cache size.
+int cache_band(int row_size) noexcept;
+
+// Size in bytes of the last-level cache, 8 MiB when the CPU does not report it.
+int cache_llc() noexcept;
+
+// Whether the CPU and the OS can run the kernels of isa (opt: 0 C .. 5 AVX512VL).
+bool isa_supported(int isa) noexcept;
+
+// Rounding r of the 1-2-1 blur (p + 2 * c + n + r) >> 2: the 2, 3, 4, 16 and 64 the filter always used at 8..16-bit,
+// 1 << (bits - 10) from 12-bit on.
+constexpr int vertical_rounding(int bits) noexcept
+{
+    return (bits == 10) ? 3 : std::max(2, 1 << std::max(bits - 10, 0));
+}
+
+// name: 0 sbrV, 1 sbr, 2 sbrH, 3 sbrStack. output: 0 the plane, 1 its difference like mt_makediff, 2 both stacked.
+// strip 0 runs whole rows; stream uses non-temporal stores. dstp may be srcp only as sbr_in_place() allows.
+using sbr_kernel = void(*)(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+// Whether dstp may be srcp: one pass of whole rows that outputs the plane.
+constexpr bool sbr_in_place(int width, int strip, int passes, int output) noexcept
+{
+    return passes == 1 && output == 0 && (strip <= 0 || strip >= width);
+}
+
+// Rows of temp_pitch that tempp holds for sbr_passes(): the kernel scratch and two buffers of band rows.
+constexpr int scratch_rows(int name, int passes, int band) noexcept
+{
+    return scratch_rows(name) + ((passes > 1) ? 2 * (band + 4 * (passes - 1)) : 0);
+}
+
+// Rows [y_begin, y_end) of kernel applied passes times, in bands whose pass k adds a halo of 2 * (passes - k) rows.
+// tempp holds scratch_rows(name, passes, band) rows; output applies to the last pass.
+template <typename T>
+void sbr_passes(sbr_kernel kernel, int passes, int band, int name, void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept
+{
+    if (passes == 1)
+    {
+        kernel(dstp, tempp, srcp, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, bits, strip, stream, output);
+        return;
+    }
+
+    const int buffer_rows{ band + 4 * (passes - 1) };
+    T* const buffers[2]{ reinterpret_cast<T*>(tempp) + scratch_rows(name) * temp_pitch, reinterpret_cast<T*>(tempp) + (scratch_rows(name) + buffer_rows) * temp_pitch };
+
+    for (int y{ y_begin }; y < y_end; y += band)
+    {
+        const int band_end{ std::min(y + band, y_end) };
+        const T* in{ reinterpret_cast<const T*>(srcp) };
+        int in_pitch{ src_pitch };
+
+        for (int pass{ 1 }; pass < passes; ++pass)
+        {
+            const int begin{ std::max(y - 2 * (passes - pass), 0) };
+            const int end{ std::min(band_end + 2 * (passes - pass), height) };
+            // The buffer holds rows [begin, end) and is addressed like the plane; the kernels touch no other rows.
+            T* out{ buffers[pass & 1] - static_cast<ptrdiff_t>(begin) * temp_pitch };
+
+            kernel(out, tempp, in, temp_pitch, temp_pitch, in_pitch, width, height, begin, end, bits, strip, false, 0);
+            in = out;
+            in_pitch = temp_pitch;
+        }
+
+        kernel(dstp, tempp, in, dst_pitch, temp_pitch, in_pitch, width, height, y, band_end, bits, strip, stream, output);
+    }
+}
+
+template <typename T, int name>
+void sbr_c(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template <int name>
+void sbr_sse2_8(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_sse2_16(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_sse2_32(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template <int name>
+void sbr_avx2_8(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx2_16(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx2_32(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template <int name>
+void sbr_avx512_8(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx512_16(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx512_32(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template <int name>
+void sbr_avx512vnni_8(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+
+template <int name>
+void sbr_avx512vl_8(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx512vl_16(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
+template <int name>
+void sbr_avx512vl_32(void* dstp, void* __restrict tempp, const void* srcp, int dst_pitch, int temp_pitch, int src_pitch, int width, int height, int y_begin, int y_end, int bits, int strip, bool stream, int output) noexcept;
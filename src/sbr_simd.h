@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "VCL2/vectorclass.h"
+
+#ifdef VCL_NAMESPACE
+using namespace VCL_NAMESPACE;
+#endif
+
+// Row helpers of the SIMD kernel files, static so that every instruction set keeps its own copy.
+
+// Loads the count lanes inside the row; nothing outside [0, width) of a row is read or written.
+template <typename V, typename T>
+static V load_simd(const T* p, int count) noexcept
+{
+    if (count >= V::size())
+        return V().load(p);
+#if INSTRSET >= 10
+    V v;
+    v.load_partial(count, p);
+    return v;
+#else
+    // load_partial() may read the whole vector when it does not cross a page.
+    T temp[V::size()]{};
+    std::memcpy(temp, p, count * sizeof(T));
+    return V().load(temp);
+#endif
+}
+
+template <typename V, typename T>
+static void store_simd(const V& v, T* p, int count) noexcept
+{
+    if (count >= V::size())
+        v.store(p);
+    else
+        v.store_partial(count, p);
+}
+
+// Stores f(x, count) for every vector of [begin, end) in dstp, which may be one of the rows f reads.
+template <typename V, typename T, typename F>
+static void row_simd(T* dstp, int begin, int end, F f) noexcept
+{
+    constexpr int size{ V::size() };
+
+#if INSTRSET >= 10
+    int x{ begin };
+
+    for (; x + size <= end; x += size)
+        f(x, size).store(dstp + x);
+
+    if (x < end)
+        store_simd(f(x, end - x), dstp + x, end - x);
+#else
+    if (end - begin < size)
+    {
+        if (end > begin)
+            store_simd(f(begin, end - begin), dstp + begin, end - begin);
+
+        return;
+    }
+
+    const V last{ f(end - size, size) };
+
+    for (int x{ begin }; x < end - size; x += size)
+        f(x, size).store(dstp + x);
+
+    last.store(dstp + end - size);
+#endif
+}
+
+// row_simd() with non-temporal stores of the aligned vectors; dstp must not be one of the rows f reads.
+template <typename V, typename T, typename F>
+static void row_stream_simd(T* dstp, int begin, int end, F f) noexcept
+{
+    constexpr int size{ V::size() };
+    const int head{ static_cast<int>((0 - reinterpret_cast<uintptr_t>(dstp + begin)) % sizeof(V) / sizeof(T)) };
+
+    if (end - begin < 2 * size || reinterpret_cast<uintptr_t>(dstp + begin + head) % sizeof(V) != 0)
+    {
+        row_simd<V>(dstp, begin, end, f);
+        return;
+    }
+
+    if (head > 0)
+        f(begin, size).store(dstp + begin);
+
+    int x{ begin + head };
+
+    for (; x + size <= end; x += size)
+        f(x, size).store_nt(dstp + x);
+
+    if (x < end)
+    {
+#if INSTRSET >= 10
+        store_simd(f(x, end - x), dstp + x, end - x);
+#else
+        f(end - size, size).store(dstp + end - size);
+#endif
+    }
+}
+
+// The output rows of the final_row functions.
+template <typename V, bool stream, typename T, typename F>
+static void output_row_simd(T* dstp, int begin, int end, F f) noexcept
+{
+    if constexpr (stream)
+        row_stream_simd<V>(dstp, begin, end, f);
+    else
+        row_simd<V>(dstp, begin, end, f);
+}
+
+// Rows of sbrH: f(left, centre, right, x, count) reads the columns around x of rowp; the edge columns are mirrored.
+template <typename V, bool stream, typename T, typename F>
+static void horizontal_row_simd(T* dstp, const T* rowp, int x_begin, int x_end, int width, F f) noexcept
+{
+    output_row_simd<V, stream>(dstp, std::max(x_begin, 1), std::min(x_end, width - 1), [&](int x, int count) noexcept { return f(rowp + x - 1, rowp + x, rowp + x + 1, x, count); });
+
+    if (x_begin == 0)
+    {
+        const T first[3]{ rowp[std::min(width - 1, 1)], rowp[0], rowp[std::min(width - 1, 1)] };
+        store_simd(f(first, first + 1, first + 2, 0, 1), dstp, 1);
+    }
+    if (x_end == width && width > 1)
+    {
+        const T last[3]{ rowp[width - 2], rowp[width - 1], rowp[width - 2] };
+        store_simd(f(last, last + 1, last + 2, width - 1, 1), dstp + width - 1, 1);
+    }
+}
@@ -0,0 +1,389 @@
+// Runs the kernels of one instruction set against the C kernels (sbr_c) and compares their output byte for byte, without an AviSynth host.
+// sbr_conformance <c|sse2|avx2|avx512|avx512vnni|avx512vl> [passes]
+// Every kernel (sbrV, sbr, sbrH and sbrStack, outputs 0..2) runs at every bit depth from 8 to 16 and on float, on planes of all widths 1..300
+// with heights 1..9 and on a few larger odd (chroma-like) sizes. The samples are random, peak, zero, peak or zero, near the peak or near the half.
+// Every case also draws how the rows are run (whole plane, bands of 1..7 rows or in place), the strip width, the non-temporal stores and the pitches.
+// The destination is compared with its padding, so a write outside [0, width) of a row fails as well.
+// c checks the C kernels against each other instead: banded and in place against whole planes, sbrStack against sbr and sbrV, sbrH against sbrV
+// of the transposed plane and the difference of output 1 against the source minus output 0.
+// passes runs sbr_passes() with 1..4 passes of sbrV, sbr and sbrH instead, against as many C kernel calls on whole planes, with bands of
+// 1..8 rows, the rows split at random y_begin like the bands of threads, strips and non-temporal stores.
+// Exits with 77 (skipped) when the CPU lacks the instruction set.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "sbr_kernels.h"
+
+struct kernel_set
+{
+    const char* isa;
+    int opt; // the tier of the kernels (opt of the filter)
+    // By name (sbrV, sbr, sbrH, sbrStack); empty for depths that the tier runs with the kernels of another one.
+    sbr_kernel k8[4];
+    sbr_kernel k16[4];
+    sbr_kernel k32[4];
+};
+
+#define SBR_KERNEL_SET(isa, opt) \
+    { #isa, opt, { sbr_##isa##_8<0>, sbr_##isa##_8<1>, sbr_##isa##_8<2>, sbr_##isa##_8<3> }, \
+        { sbr_##isa##_16<0>, sbr_##isa##_16<1>, sbr_##isa##_16<2>, sbr_##isa##_16<3> }, \
+        { sbr_##isa##_32<0>, sbr_##isa##_32<1>, sbr_##isa##_32<2>, sbr_##isa##_32<3> } }
+
+static const kernel_set kernel_sets[]
+{
+    { "c", 0, { sbr_c<uint8_t, 0>, sbr_c<uint8_t, 1>, sbr_c<uint8_t, 2>, sbr_c<uint8_t, 3> },
+        { sbr_c<uint16_t, 0>, sbr_c<uint16_t, 1>, sbr_c<uint16_t, 2>, sbr_c<uint16_t, 3> },
+        { sbr_c<float, 0>, sbr_c<float, 1>, sbr_c<float, 2>, sbr_c<float, 3> } },
+    SBR_KERNEL_SET(sse2, 1),
+    SBR_KERNEL_SET(avx2, 2),
+    SBR_KERNEL_SET(avx512, 3),
+    { "avx512vnni", 4, { sbr_avx512vnni_8<0>, sbr_avx512vnni_8<1>, sbr_avx512vnni_8<2>, sbr_avx512vnni_8<3> }, {}, {} },
+    SBR_KERNEL_SET(avx512vl, 5),
+};
+
+static const char* const names[]{ "sbrV", "sbr", "sbrH", "sbrStack" };
+
+// Larger planes with odd sizes like the chroma of odd frames.
+static const int odd_sizes[][2]{ { 427, 241 }, { 361, 289 }, { 960, 541 }, { 65, 17 }, { 129, 3 }, { 1023, 2 } };
+
+static long cases{ 0 };
+static long failures{ 0 };
+
+// values: 0 random, 1 peak, 2 zero, 3 peak or zero, 4 near the peak, 5 near the half. Float samples are 0..1, except 4, which is
+// zero-centred like chroma.
+template <typename T>
+static void fill(std::vector<T>& v, int values, int bits, std::mt19937& rng)
+{
+    for (T& x : v)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            const float r{ std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) };
+
+            switch (values)
+            {
+                case 0: x = r; break;
+                case 1: x = 1.0f; break;
+                case 2: x = 0.0f; break;
+                case 3: x = (rng() & 1) ? 1.0f : 0.0f; break;
+                case 4: x = r - 0.5f; break;
+                default: x = 0.5f + (r - 0.5f) * 0.01f; break;
+            }
+        }
+        else
+        {
+            const int peak{ (1 << bits) - 1 };
+
+            switch (values)
+            {
+                case 0: x = static_cast<T>(rng() & peak); break;
+                case 1: x = static_cast<T>(peak); break;
+                case 2: x = 0; break;
+                case 3: x = static_cast<T>((rng() & 1) ? peak : 0); break;
+                case 4: x = static_cast<T>(peak - rng() % 4); break;
+                default: x = static_cast<T>((peak + 1) / 2 + static_cast<int>(rng() % 9) - 4); break;
+            }
+        }
+    }
+}
+
+// Filters rows [0, height) like the filter does: in one call or, with bands, in calls of 1..7 rows.
+template <typename T>
+static void filter(sbr_kernel kernel, int name, T* dstp, const T* srcp, int dst_pitch, int src_pitch, int width, int height, int bits, int strip, bool stream, int output, bool bands, std::mt19937& rng)
+{
+    const int temp_pitch{ (width + 64 / static_cast<int>(sizeof(T)) - 1) & ~(64 / static_cast<int>(sizeof(T)) - 1) };
+    std::vector<T> temp(static_cast<size_t>(temp_pitch) * scratch_rows(name));
+
+    for (int y_begin{ 0 }; y_begin < height;)
+    {
+        const int y_end{ (bands) ? std::min(y_begin + 1 + static_cast<int>(rng() % 7), height) : height };
+        kernel(dstp, temp.data(), srcp, dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, bits, strip, stream, output);
+        y_begin = y_end;
+    }
+}
+
+// Reports the first sample in which actual differs from expected.
+template <typename T>
+static bool compare(const std::vector<T>& actual, const std::vector<T>& expected, int pitch, const char* what)
+{
+    ++cases;
+
+    if (std::memcmp(actual.data(), expected.data(), actual.size() * sizeof(T)) == 0)
+        return true;
+
+    size_t i{ 0 };
+
+    while (std::memcmp(&actual[i], &expected[i], sizeof(T)) == 0)
+        ++i;
+
+    if (++failures <= 20)
+        printf("%s: (%d, %d) is %g, expected %g\n", what, static_cast<int>(i % pitch), static_cast<int>(i / pitch), static_cast<double>(actual[i]), static_cast<double>(expected[i]));
+
+    return false;
+}
+
+// One plane through kernel and reference. The rows run as drawn from rng: whole (mode 0), in bands (1) or in place (2, whole rows without strips,
+// the plane only, see sbr_in_place()).
+template <typename T>
+static void check(const char* isa, sbr_kernel kernel, sbr_kernel reference, int name, int bits, int width, int height, int values, int output, std::mt19937& rng)
+{
+    const int outputs{ (name == 3 || output == 2) ? 2 : 1 };
+    const int mode{ static_cast<int>(rng() % ((name != 3 && output == 0) ? 3 : 2)) };
+    const int src_pitch{ width + static_cast<int>(rng() % 4) };
+    const int dst_pitch{ (mode == 2) ? src_pitch : width + static_cast<int>(rng() % 4) };
+    const int strip{ (mode == 2 || rng() % 3 == 0) ? 0 : 1 + static_cast<int>(rng() % (width + 8)) };
+    const bool stream{ mode != 2 && (rng() & 1) != 0 };
+
+    std::vector<T> src(static_cast<size_t>(src_pitch) * height);
+    fill(src, values, bits, rng);
+
+    // The destination starts as the source in place and as noise otherwise, the same for both kernels.
+    std::vector<T> expected(static_cast<size_t>(dst_pitch) * height * outputs);
+
+    if (mode == 2)
+        expected = src;
+    else
+        fill(expected, 0, bits, rng);
+
+    std::vector<T> actual(expected);
+
+    filter(reference, name, expected.data(), src.data(), dst_pitch, src_pitch, width, height, bits, 0, false, output, false, rng);
+    filter(kernel, name, actual.data(), (mode == 2) ? actual.data() : src.data(), dst_pitch, src_pitch, width, height, bits, strip, stream, output, mode == 1, rng);
+
+    char what[256];
+    snprintf(what, sizeof(what), "%s %s %d-bit %dx%d values %d output %d mode %d strip %d stream %d", isa, names[name], bits, width, height, values, output, mode, strip, stream);
+    compare(actual, expected, dst_pitch, what);
+}
+
+// sbrStack is sbr above sbrV, and output 2 is output 0 above output 1 (the C kernels compute them in different ways).
+// The difference of output 1 is src - output + half for integer samples.
+template <typename T>
+static void check_outputs(const kernel_set& set, int bits, int width, int height, int values, std::mt19937& rng)
+{
+    const sbr_kernel* kernels{ (sizeof(T) == 1) ? set.k8 : ((sizeof(T) == 2) ? set.k16 : set.k32) };
+    const size_t size{ static_cast<size_t>(width) * height };
+
+    std::vector<T> src(size);
+    fill(src, values, bits, rng);
+
+    for (int name{ 0 }; name < 3; ++name)
+    {
+        std::vector<T> planes[3]{ std::vector<T>(size), std::vector<T>(size), std::vector<T>(size * 2) };
+
+        for (int output{ 0 }; output < 3; ++output)
+            filter(kernels[name], name, planes[output].data(), src.data(), width, width, width, height, bits, 0, false, output, false, rng);
+
+        char what[256];
+        snprintf(what, sizeof(what), "c %s output 2 %d-bit %dx%d values %d", names[name], bits, width, height, values);
+        std::vector<T> both(planes[0]);
+        both.insert(both.end(), planes[1].begin(), planes[1].end());
+        compare(planes[2], both, width, what);
+
+        if constexpr (std::is_integral_v<T>)
+        {
+            std::vector<T> difference(size);
+
+            for (size_t i{ 0 }; i < size; ++i)
+                difference[i] = static_cast<T>(src[i] - planes[0][i] + (1 << (bits - 1)));
+
+            snprintf(what, sizeof(what), "c %s output 1 %d-bit %dx%d values %d", names[name], bits, width, height, values);
+            compare(planes[1], difference, width, what);
+        }
+    }
+
+    std::vector<T> stack(size * 2);
+    std::vector<T> separate(size * 2);
+    filter(kernels[3], 3, stack.data(), src.data(), width, width, width, height, bits, 0, false, 0, false, rng);
+    filter(kernels[1], 1, separate.data(), src.data(), width, width, width, height, bits, 0, false, 0, false, rng);
+    filter(kernels[0], 0, separate.data() + size, src.data(), width, width, width, height, bits, 0, false, 0, false, rng);
+
+    char what[256];
+    snprintf(what, sizeof(what), "c sbrStack %d-bit %dx%d values %d", bits, width, height, values);
+    compare(stack, separate, width, what);
+
+    // sbrH is TurnLeft().sbrV().TurnRight().
+    std::vector<T> transposed(size);
+    std::vector<T> vertical(size);
+    std::vector<T> horizontal(size);
+    std::vector<T> turned(size);
+
+    for (int y{ 0 }; y < height; ++y)
+        for (int x{ 0 }; x < width; ++x)
+            transposed[static_cast<size_t>(x) * height + y] = src[static_cast<size_t>(y) * width + x];
+
+    filter(kernels[0], 0, vertical.data(), transposed.data(), height, height, height, width, bits, 0, false, 0, false, rng);
+    filter(kernels[2], 2, horizontal.data(), src.data(), width, width, width, height, bits, 0, false, 0, false, rng);
+
+    for (int y{ 0 }; y < height; ++y)
+        for (int x{ 0 }; x < width; ++x)
+            turned[static_cast<size_t>(y) * width + x] = vertical[static_cast<size_t>(x) * height + y];
+
+    snprintf(what, sizeof(what), "c sbrH %d-bit %dx%d values %d", bits, width, height, values);
+    compare(horizontal, turned, width, what);
+}
+
+template <typename T>
+static void check_depth(const kernel_set& set, int bits)
+{
+    const sbr_kernel* kernels{ (sizeof(T) == 1) ? set.k8 : ((sizeof(T) == 2) ? set.k16 : set.k32) };
+    const sbr_kernel* references{ (sizeof(T) == 1) ? kernel_sets[0].k8 : ((sizeof(T) == 2) ? kernel_sets[0].k16 : kernel_sets[0].k32) };
+
+    if (!kernels[0])
+        return;
+
+    std::mt19937 rng(bits);
+
+    for (int name{ 0 }; name < 4; ++name)
+    {
+        // sbrStack writes only planes.
+        for (int output{ 0 }; output <= ((name == 3) ? 0 : 2); ++output)
+        {
+            // The nine heights of a width take every kind of values.
+            for (int width{ 1 }; width <= 300; ++width)
+                for (int height{ 1 }; height <= 9; ++height)
+                    check<T>(set.isa, kernels[name], references[name], name, bits, width, height, (width + height) % 6, output, rng);
+
+            for (const auto& s : odd_sizes)
+                for (int values{ 0 }; values < 6; ++values)
+                    check<T>(set.isa, kernels[name], references[name], name, bits, s[0], s[1], values, output, rng);
+        }
+    }
+
+    if (set.opt == 0)
+    {
+        for (int width{ 1 }; width <= 70; ++width)
+            for (int height{ 1 }; height <= 9; ++height)
+                check_outputs<T>(set, bits, width, height, (width + height) % 6, rng);
+    }
+}
+
+// passes applications of one kernel through sbr_passes() against as many calls of the reference on whole planes, each on the output of the
+// one before. The rows run in one call or split at random like the bands of threads; band is the band of sbr_passes(), 1..8 rows.
+template <typename T>
+static void check_passes(const char* isa, sbr_kernel kernel, sbr_kernel reference, int name, int bits, int width, int height, int values, int passes,
+    std::mt19937& rng)
+{
+    const int temp_pitch{ (width + 64 / static_cast<int>(sizeof(T)) - 1) & ~(64 / static_cast<int>(sizeof(T)) - 1) };
+    const int output{ static_cast<int>(rng() % 3) };
+    const int outputs{ (output == 2) ? 2 : 1 };
+    const int src_pitch{ width + static_cast<int>(rng() % 4) };
+    const int dst_pitch{ width + static_cast<int>(rng() % 4) };
+    const int strip{ (rng() % 3 == 0) ? 0 : 1 + static_cast<int>(rng() % (width + 8)) };
+    const bool stream{ (rng() & 1) != 0 };
+    const bool split{ (rng() & 1) != 0 };
+    const int band{ 1 + static_cast<int>(rng() % 8) };
+
+    std::vector<T> src(static_cast<size_t>(src_pitch) * height);
+    fill(src, values, bits, rng);
+
+    std::vector<T> expected(static_cast<size_t>(dst_pitch) * height * outputs);
+    fill(expected, 0, bits, rng);
+
+    std::vector<T> actual(expected);
+
+    // The reference, pass by pass on whole planes.
+    std::vector<T> in(src);
+    int in_pitch{ src_pitch };
+
+    for (int pass{ 1 }; pass < passes; ++pass)
+    {
+        std::vector<T> out(static_cast<size_t>(width) * height);
+        filter(reference, name, out.data(), in.data(), width, in_pitch, width, height, bits, 0, false, 0, false, rng);
+        in = std::move(out);
+        in_pitch = width;
+    }
+
+    filter(reference, name, expected.data(), in.data(), dst_pitch, in_pitch, width, height, bits, 0, false, output, false, rng);
+
+    std::vector<T> temp(static_cast<size_t>(temp_pitch) * scratch_rows(name, passes, band));
+
+    for (int y_begin{ 0 }; y_begin < height;)
+    {
+        const int y_end{ (split) ? std::min(y_begin + 1 + static_cast<int>(rng() % 7), height) : height };
+        sbr_passes<T>(kernel, passes, band, name, actual.data(), temp.data(), src.data(), dst_pitch, temp_pitch, src_pitch, width, height, y_begin, y_end, bits,
+            strip, stream, output);
+        y_begin = y_end;
+    }
+
+    char what[256];
+    snprintf(what, sizeof(what), "%s %s %d-bit %dx%d values %d passes %d band %d output %d split %d strip %d stream %d", isa, names[name], bits, width, height,
+        values, passes, band, output, split, strip, stream);
+    compare(actual, expected, dst_pitch, what);
+}
+
+template <typename T>
+static void check_passes_depth(const kernel_set& set, int bits)
+{
+    const sbr_kernel* kernels{ (sizeof(T) == 1) ? set.k8 : ((sizeof(T) == 2) ? set.k16 : set.k32) };
+    const sbr_kernel* references{ (sizeof(T) == 1) ? kernel_sets[0].k8 : ((sizeof(T) == 2) ? kernel_sets[0].k16 : kernel_sets[0].k32) };
+
+    if (!kernels[0])
+        return;
+
+    std::mt19937 rng(bits);
+
+    // sbrStack has no second pass. Heights from 1 are lower than the halo of the first passes.
+    for (int name{ 0 }; name < 3; ++name)
+    {
+        for (int passes{ 1 }; passes <= 4; ++passes)
+        {
+            for (int width{ 1 }; width <= 80; ++width)
+                for (int height{ 1 }; height <= 9; ++height)
+                    check_passes<T>(set.isa, kernels[name], references[name], name, bits, width, height, (width + height) % 6, passes, rng);
+
+            for (const auto& s : odd_sizes)
+                check_passes<T>(set.isa, kernels[name], references[name], name, bits, s[0], s[1], passes % 6, passes, rng);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const kernel_set* set{ nullptr };
+    const bool passes{ argc == 3 && !strcmp(argv[2], "passes") };
+
+    for (const kernel_set& s : kernel_sets)
+    {
+        if ((argc == 2 || passes) && !strcmp(argv[1], s.isa))
+            set = &s;
+    }
+
+    if (!set)
+    {
+        fprintf(stderr, "usage: %s <c|sse2|avx2|avx512|avx512vnni|avx512vl> [passes]\n", argv[0]);
+        return 1;
+    }
+
+    if (!isa_supported(set->opt))
+    {
+        printf("%s: not supported by the CPU, skipped\n", set->isa);
+        return 77;
+    }
+
+    if (passes)
+    {
+        check_passes_depth<uint8_t>(*set, 8);
+
+        for (int bits{ 9 }; bits <= 16; ++bits)
+            check_passes_depth<uint16_t>(*set, bits);
+
+        check_passes_depth<float>(*set, 32);
+    }
+    else
+    {
+        check_depth<uint8_t>(*set, 8);
+
+        for (int bits{ 9 }; bits <= 16; ++bits)
+            check_depth<uint16_t>(*set, bits);
+
+        check_depth<float>(*set, 32);
+    }
+
+    printf("%s%s: %ld cases, %ld failed\n", set->isa, (passes) ? " passes" : "", cases, failures);
+    return (failures) ? 1 : 0;
+}
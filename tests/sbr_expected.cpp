@@ -0,0 +1,263 @@
+// Checks the C kernels (sbr_c) against values known in advance, without an AviSynth host. sbr_conformance holds the SIMD kernels to the C ones,
+// so what is checked here holds for all of them.
+// - A flat plane has no detail. sbr returns it unchanged; sbrV and sbrH add the bias of their rounding, r >> 2 of vertical_rounding() (1 at
+//   12-bit, 4 at 14-bit and 16 at 16-bit), but not past the peak. The difference (output 1) is the half minus that bias. This covers every
+//   sample value of every bit depth 8..16; before the blur was capped at the peak, a flat white plane came back as 4096 at 12-bit, as 16387
+//   at 14-bit and as 32768 (the blur wrapped) at 16-bit.
+// - sbrV of flat planes at and near the peak at 12, 14 and 16-bit is pinned to the peak.
+// - Output samples stay within [0, peak] on planes of samples near the peak and of peak and zero.
+// - sbrV at every bit depth 8..16 equals a plain reimplementation of the original filter (capped at the peak) that takes the rounding constant
+//   of the blur from a table instead of vertical_rounding(): 2, 3, 4, 16 and 64 as the filter always used at 8, 10, 12, 14 and 16-bit, and
+//   2, 2, 8 and 32 at 9, 11, 13 and 15-bit. The sums of the planes take every remainder modulo 4, so r is checked, not only r >> 2.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "sbr_kernels.h"
+
+static const sbr_kernel kernels8[]{ sbr_c<uint8_t, 0>, sbr_c<uint8_t, 1>, sbr_c<uint8_t, 2>, sbr_c<uint8_t, 3> };
+static const sbr_kernel kernels16[]{ sbr_c<uint16_t, 0>, sbr_c<uint16_t, 1>, sbr_c<uint16_t, 2>, sbr_c<uint16_t, 3> };
+static const sbr_kernel kernels32[]{ sbr_c<float, 0>, sbr_c<float, 1>, sbr_c<float, 2>, sbr_c<float, 3> };
+
+static const char* const names[]{ "sbrV", "sbr", "sbrH", "sbrStack" };
+
+static long cases{ 0 };
+static long failures{ 0 };
+
+// Filters src (width x height) with output and returns what the kernel wrote.
+template <typename T>
+static std::vector<T> filter(int name, const std::vector<T>& src, int width, int height, int bits, int output)
+{
+    const sbr_kernel kernel{ (sizeof(T) == 1) ? kernels8[name] : ((sizeof(T) == 2) ? kernels16[name] : kernels32[name]) };
+    const int temp_pitch{ (width + 63) & ~63 };
+    std::vector<T> temp(static_cast<size_t>(temp_pitch) * scratch_rows(name));
+    std::vector<T> dst(src.size() * ((name == 3 || output == 2) ? 2 : 1));
+
+    kernel(dst.data(), temp.data(), src.data(), width, temp_pitch, width, width, height, 0, height, bits, 0, false, output);
+    return dst;
+}
+
+// Reports the first sample of dst outside [low(i), high(i)].
+template <typename T, typename L, typename H>
+static void expect(const std::vector<T>& dst, int width, L low, H high, const char* what)
+{
+    ++cases;
+
+    for (size_t i{ 0 }; i < dst.size(); ++i)
+    {
+        if (dst[i] < low(i) || dst[i] > high(i))
+        {
+            if (++failures <= 20)
+                printf("%s: (%d, %d) is %g, expected %g..%g\n", what, static_cast<int>(i % width), static_cast<int>(i / width), static_cast<double>(dst[i]),
+                    static_cast<double>(low(i)), static_cast<double>(high(i)));
+
+            return;
+        }
+    }
+}
+
+// Every flat plane of the depth through every kernel.
+template <typename T>
+static void check_flat(int bits, const std::vector<T>& values)
+{
+    const int width{ 9 };
+    const int height{ 5 };
+    const size_t size{ static_cast<size_t>(width) * height };
+
+    for (const T value : values)
+    {
+        const std::vector<T> src(size, value);
+        T vertical{ value };
+        T half{ 0 };
+
+        if constexpr (std::is_integral_v<T>)
+        {
+            vertical = static_cast<T>(std::min(value + (vertical_rounding(bits) >> 2), (1 << bits) - 1));
+            half = static_cast<T>(1 << (bits - 1));
+        }
+
+        // By name; sbrStack is sbr above sbrV.
+        const T planes[4]{ vertical, value, vertical, value };
+
+        for (int name{ 0 }; name < 4; ++name)
+        {
+            const auto plane{ [&](size_t i) noexcept { return (i < size) ? planes[name] : vertical; } };
+            char what[256];
+            snprintf(what, sizeof(what), "%s %d-bit flat %g", names[name], bits, static_cast<double>(value));
+            expect(filter(name, src, width, height, bits, 0), width, plane, plane, what);
+
+            // sbrStack writes only planes.
+            if (name < 3)
+            {
+                const auto difference{ [&](size_t) noexcept { return static_cast<T>(value - planes[name] + half); } };
+                snprintf(what, sizeof(what), "%s %d-bit flat %g output 1", names[name], bits, static_cast<double>(value));
+                expect(filter(name, src, width, height, bits, 1), width, difference, difference, what);
+            }
+        }
+    }
+}
+
+// values: 0 near the peak, 1 peak or zero.
+template <typename T>
+static void check_range(int bits)
+{
+    const int peak{ (1 << bits) - 1 };
+    std::mt19937 rng(bits);
+
+    for (int values{ 0 }; values < 2; ++values)
+    {
+        for (int height{ 1 }; height <= 9; ++height)
+        {
+            const int width{ 37 };
+            std::vector<T> src(static_cast<size_t>(width) * height);
+
+            for (T& x : src)
+                x = static_cast<T>((values == 0) ? peak - static_cast<int>(rng() % 4) : ((rng() & 1) ? peak : 0));
+
+            for (int name{ 0 }; name < 4; ++name)
+            {
+                char what[256];
+                snprintf(what, sizeof(what), "%s %d-bit %dx%d values %d", names[name], bits, width, height, values);
+                expect(filter(name, src, width, height, bits, 0), width, [](size_t) noexcept { return T(0); },
+                    [peak](size_t) noexcept { return static_cast<T>(peak); }, what);
+            }
+        }
+    }
+}
+
+// The original sbrV: blur the plane vertically, take the difference (rg11D), blur that and select. The edge rows mirror the row inside.
+template <typename T>
+static std::vector<T> original_sbrV(const std::vector<T>& src, int width, int height, int bits)
+{
+    static const int rounding[17]{ 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 3, 2, 4, 8, 16, 32, 64 };
+
+    const int r{ rounding[bits] };
+    const int peak{ (1 << bits) - 1 };
+    const int half{ 1 << (bits - 1) };
+    const auto blur{ [&](const std::vector<int>& plane, int x, int y) noexcept
+        {
+            const int above{ plane[static_cast<size_t>((y == 0) ? std::min(1, height - 1) : y - 1) * width + x] };
+            const int below{ plane[static_cast<size_t>((y == height - 1) ? std::max(height - 2, 0) : y + 1) * width + x] };
+            return std::min((above + 2 * plane[static_cast<size_t>(y) * width + x] + below + r) >> 2, peak);
+        } };
+
+    const std::vector<int> s(src.begin(), src.end());
+    std::vector<int> diff(s.size());
+    std::vector<T> dst(s.size());
+
+    for (int y{ 0 }; y < height; ++y)
+        for (int x{ 0 }; x < width; ++x)
+            diff[static_cast<size_t>(y) * width + x] = std::max(std::min(s[static_cast<size_t>(y) * width + x] - blur(s, x, y) + half, peak), 0);
+
+    for (int y{ 0 }; y < height; ++y)
+    {
+        for (int x{ 0 }; x < width; ++x)
+        {
+            const size_t i{ static_cast<size_t>(y) * width + x };
+            const long long t{ diff[i] - blur(diff, x, y) };
+            const long long t2{ diff[i] - half };
+
+            if (t * t2 < 0)
+                dst[i] = static_cast<T>(s[i]);
+            else if (std::abs(t) < std::abs(t2))
+                dst[i] = static_cast<T>(s[i] - t);
+            else
+                dst[i] = static_cast<T>(s[i] - diff[i] + half);
+        }
+    }
+
+    return dst;
+}
+
+// sbrV of flat planes at and near the peak, pinned: the blur stops at the peak. The uncapped blur of the original filter returned a white
+// plane as 4096 at 12-bit, 16387 at 14-bit and 32768 at 16-bit.
+static void check_capped()
+{
+    struct capped
+    {
+        int bits;
+        uint16_t value;
+        uint16_t plane; // output 0
+        uint16_t difference; // output 1
+    };
+
+    static const capped table[]
+    {
+        { 12, 4095, 4095, 2048 },
+        { 12, 4094, 4095, 2047 },
+        { 14, 16383, 16383, 8192 },
+        { 14, 16380, 16383, 8189 },
+        { 16, 65535, 65535, 32768 },
+        { 16, 65520, 65535, 32753 },
+        { 16, 65519, 65535, 32752 },
+    };
+
+    for (const capped& c : table)
+    {
+        const std::vector<uint16_t> src(9 * 5, c.value);
+        char what[256];
+        snprintf(what, sizeof(what), "sbrV %d-bit flat %d capped", c.bits, c.value);
+        expect(filter(0, src, 9, 5, c.bits, 0), 9, [&](size_t) noexcept { return c.plane; }, [&](size_t) noexcept { return c.plane; }, what);
+        snprintf(what, sizeof(what), "sbrV %d-bit flat %d capped output 1", c.bits, c.value);
+        expect(filter(0, src, 9, 5, c.bits, 1), 9, [&](size_t) noexcept { return c.difference; }, [&](size_t) noexcept { return c.difference; }, what);
+    }
+}
+
+// Planes of consecutive samples around the half and of random samples.
+template <typename T>
+static void check_rounding(int bits)
+{
+    std::mt19937 rng(bits);
+
+    for (int values{ 0 }; values < 2; ++values)
+    {
+        for (int height{ 1 }; height <= 9; ++height)
+        {
+            const int width{ 64 };
+            std::vector<T> src(static_cast<size_t>(width) * height);
+
+            for (size_t i{ 0 }; i < src.size(); ++i)
+                src[i] = static_cast<T>((values == 0) ? (1 << (bits - 1)) - 16 + static_cast<int>(i % 37) : rng() & ((1 << bits) - 1));
+
+            const std::vector<T> expected{ original_sbrV(src, width, height, bits) };
+            const auto sample{ [&](size_t i) noexcept { return expected[i]; } };
+
+            char what[256];
+            snprintf(what, sizeof(what), "sbrV %d-bit %dx%d values %d against the original", bits, width, height, values);
+            expect(filter(0, src, width, height, bits, 0), width, sample, sample, what);
+        }
+    }
+}
+
+int main()
+{
+    std::vector<uint8_t> values8(256);
+
+    for (int i{ 0 }; i < 256; ++i)
+        values8[i] = static_cast<uint8_t>(i);
+
+    check_flat<uint8_t>(8, values8);
+    check_range<uint8_t>(8);
+    check_rounding<uint8_t>(8);
+
+    for (int bits{ 9 }; bits <= 16; ++bits)
+    {
+        std::vector<uint16_t> values(static_cast<size_t>(1) << bits);
+
+        for (size_t i{ 0 }; i < values.size(); ++i)
+            values[i] = static_cast<uint16_t>(i);
+
+        check_flat<uint16_t>(bits, values);
+        check_range<uint16_t>(bits);
+        check_rounding<uint16_t>(bits);
+    }
+
+    check_capped();
+    check_flat<float>(32, { -0.5f, 0.0f, 0.5f, 1.0f });
+
+    printf("expected: %ld cases, %ld failed\n", cases, failures);
+    return (failures) ? 1 : 0;
+}
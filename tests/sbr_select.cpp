@@ -0,0 +1,97 @@
+// Proves the 8-bit select of one instruction set equal to the select of the original filter on all 2^24 (src, dst, temp) triples, not just
+// those that a plane can produce. The original corrects by t = dst - temp unless t and t2 = dst - 128 have different signs, by t2 when
+// |t2| <= |t|, and stores src minus the correction in a byte; the kernels compute median(t, t2, 0) instead. The difference (output 1) is
+// checked against src - output + 128 in a byte.
+// The select is static, so this file includes the kernel file of the instruction set (SBR_SELECT_SOURCE) and is built with its flags, once per
+// instruction set; SBR_SELECT_ISA names it, SBR_SELECT_FUNCTION is its select and SBR_SELECT_OPT is its tier for isa_supported().
+// Exits with 77 (skipped) when the CPU lacks the instruction set.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include SBR_SELECT_SOURCE
+
+#define SBR_SELECT_STRING2(x) #x
+#define SBR_SELECT_STRING(x) SBR_SELECT_STRING2(x)
+
+static uint8_t select_original(int src, int dst, int temp) noexcept
+{
+    const int t{ dst - temp };
+    const int t2{ dst - 128 };
+
+    if (t * t2 < 0)
+        return static_cast<uint8_t>(src);
+    else if (std::abs(t) < std::abs(t2))
+        return static_cast<uint8_t>(src - t);
+    else
+        return static_cast<uint8_t>(src - dst + 128);
+}
+
+static long failures{ 0 };
+
+static void check(int src, int dst, int temp, int output, int diff)
+{
+    const uint8_t original{ select_original(src, dst, temp) };
+
+    if (output != original || diff != static_cast<uint8_t>(src - original + 128))
+    {
+        if (++failures <= 20)
+            printf("%s: src %d dst %d temp %d is %d (difference %d), expected %d\n", SBR_SELECT_STRING(SBR_SELECT_ISA), src, dst, temp, output, diff, original);
+    }
+}
+
+#ifdef SBR_SELECT_C
+static void check_all()
+{
+    for (int dst{ 0 }; dst < 256; ++dst)
+        for (int temp{ 0 }; temp < 256; ++temp)
+            for (int src{ 0 }; src < 256; ++src)
+                check(src, dst, temp, select_c<uint8_t, int, false>(src, dst, temp, 128), select_c<uint8_t, int, true>(src, dst, temp, 128));
+}
+#else
+// The vectors hold consecutive src values with the same dst and temp.
+template <typename V>
+static void check_all(V(*select)(const V&, const V&, const V&), V(*select_diff)(const V&, const V&, const V&))
+{
+    uint8_t src[256];
+
+    for (int i{ 0 }; i < 256; ++i)
+        src[i] = static_cast<uint8_t>(i);
+
+    for (int dst{ 0 }; dst < 256; ++dst)
+    {
+        for (int temp{ 0 }; temp < 256; ++temp)
+        {
+            for (int x{ 0 }; x < 256; x += V::size())
+            {
+                uint8_t output[V::size()];
+                uint8_t diff[V::size()];
+                const V s{ V().load(src + x) };
+                select(s, V(dst), V(temp)).store(output);
+                select_diff(s, V(dst), V(temp)).store(diff);
+
+                for (int i{ 0 }; i < V::size(); ++i)
+                    check(x + i, dst, temp, output[i], diff[i]);
+            }
+        }
+    }
+}
+#endif
+
+int main()
+{
+    if (!isa_supported(SBR_SELECT_OPT))
+    {
+        printf("%s: not supported by the CPU, skipped\n", SBR_SELECT_STRING(SBR_SELECT_ISA));
+        return 77;
+    }
+
+#ifdef SBR_SELECT_C
+    check_all();
+#else
+    check_all(SBR_SELECT_FUNCTION<false>, SBR_SELECT_FUNCTION<true>);
+#endif
+
+    printf("%s: 16777216 triples, %ld failed\n", SBR_SELECT_STRING(SBR_SELECT_ISA), failures);
+    return (failures) ? 1 : 0;
+}
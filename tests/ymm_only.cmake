@@ -0,0 +1,18 @@
+# Fails when the disassembly of OBJECT uses zmm registers. Run by the test avx512vl_ymm_only:
+# cmake -DOBJDUMP=<objdump> -DOBJECT=<object file> -P ymm_only.cmake
+execute_process(COMMAND ${OBJDUMP} -d ${OBJECT} OUTPUT_VARIABLE disassembly RESULT_VARIABLE result)
+
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${OBJDUMP} -d ${OBJECT} failed")
+endif ()
+
+string(REGEX MATCHALL "[^\n]*%zmm[0-9]+[^\n]*" lines "${disassembly}")
+list(LENGTH lines count)
+
+if (count GREATER 0)
+    list(SUBLIST lines 0 10 first)
+    string(REPLACE ";" "\n" first "${first}")
+    message(FATAL_ERROR "${OBJECT}: ${count} instructions use zmm registers, e.g.\n${first}")
+endif ()
+
+message(STATUS "${OBJECT}: no zmm registers")